@@ -0,0 +1,469 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchMode.h"
+#include "DirectoryWalker.h"
+#include "DuplicateFinder.h"
+#include "ImageHash.h"
+#include "ImageViewer.h"
+#include "Parallel.h"
+#include "Phototonic.h"
+#include "PipelineStats.h"
+#include "Settings.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailWriter.h"
+#include "ThumbsViewer.h"
+#include "Trace.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScopeGuard>
+#include <QSet>
+#include <QTextStream>
+
+#include <atomic>
+#include <cstdlib>
+
+#include <exiv2/exiv2.hpp>
+
+namespace { // anonymous, not visible outside of this file
+
+const char generateThumbnailsCommand[] = "generate-thumbnails";
+const char findDuplicatesCommand[] = "find-duplicates";
+const char batchTransformCommand[] = "batch-transform";
+
+// The settings the batch commands depend on, with the same defaults as the viewer
+void readSettings()
+{
+    Settings::appSettings =
+        new QSettings(QStringLiteral("phototonic"), QStringLiteral("phototonic"));
+    Settings::thumbsLayout =
+        Settings::appSettings->value(Settings::optionThumbsLayout, ThumbsViewer::Classic).toUInt();
+    Settings::exifThumbRotationEnabled =
+        Settings::appSettings->value(Settings::optionExifThumbRotationEnabled, false).toBool();
+    Settings::showHiddenFiles =
+        Settings::appSettings->value(Settings::optionShowHiddenFiles, false).toBool();
+    Settings::defaultSaveQuality =
+        Settings::appSettings->value(Settings::optionDefaultSaveQuality, 90).toInt();
+    Settings::thumbsPackedStore =
+        Settings::appSettings->value(Settings::optionThumbsPackedStore, false).toBool();
+    Settings::directoryScanThreads =
+        Settings::appSettings->value(Settings::optionDirectoryScanThreads, 4).toInt();
+    Settings::duplicateHashDistance =
+        Settings::appSettings->value(Settings::optionDuplicateHashDistance, 4).toInt();
+    Settings::exactDuplicatesOnly =
+        Settings::appSettings->value(Settings::optionExactDuplicatesOnly, false).toBool();
+    Settings::duplicateHashMethod =
+        Settings::appSettings
+            ->value(Settings::optionDuplicateHashMethod, ImageHash::DifferenceHash)
+            .toInt();
+    Settings::rotation = 0;
+    Settings::flipH = false;
+    Settings::flipV = false;
+}
+
+// The images in the directory, and in all directories below it if recursive is set
+QFileInfoList findImages(const QString &directory, bool recursive)
+{
+    QDir::Filters filters = QDir::Files;
+    if (Settings::showHiddenFiles) {
+        filters |= QDir::Hidden;
+    }
+
+    const QStringList &nameFilters = FileNameFilter::imageNameFilters();
+    QFileInfoList fileInfos = QDir(directory).entryInfoList(nameFilters, filters, QDir::Name);
+    if (recursive) {
+        DirectoryWalker directoryWalker(directory, filters, nameFilters,
+                                        Settings::directoryScanThreads);
+        directoryWalker.start();
+
+        QVector<DirectoryListing> listings;
+        while (directoryWalker.takeListings(&listings, 50)) {
+            for (const DirectoryListing &listing : qAsConst(listings)) {
+                fileInfos.append(listing.fileInfos);
+            }
+        }
+    }
+    return fileInfos;
+}
+
+// Runs function(index) for every index below count on one thread per core. Every thread takes
+// the next index when it is done with the last one, as images take very different times.
+template<typename Function>
+void forEachOnAllCores(int count, const Function &function)
+{
+    std::atomic<int> nextIndex(0);
+    Parallel::forChunks(QThread::idealThreadCount(), 1, [&](int, int) {
+        for (int index = nextIndex++; index < count; index = nextIndex++) {
+            function(index);
+        }
+    });
+}
+
+void reportThroughput(const QString &what, int count, int failed, const QElapsedTimer &timer)
+{
+    const double seconds = double(timer.nsecsElapsed()) / 1e9;
+    QTextStream err(stderr);
+    err << what << ": " << count << " images in " << QString::number(seconds, 'f', 2) << " s, "
+        << QString::number(seconds > 0 ? count / seconds : 0, 'f', 1) << " images/s";
+    if (failed > 0) {
+        err << ", " << failed << " failed";
+    }
+    err << Qt::endl;
+}
+
+int generateThumbnails(const QFileInfoList &fileInfos)
+{
+    const int thumbSize =
+        Settings::appSettings->value(Settings::optionThumbsZoomLevel, 200).toInt();
+
+    // QFileInfo caches lazily and may not be shared between threads, so the requests are
+    // complete before the workers start
+    QVector<ThumbnailRequest> requests;
+    requests.reserve(fileInfos.size());
+    for (const QFileInfo &fileInfo : fileInfos) {
+        ThumbnailRequest request;
+        request.filePath = fileInfo.filePath();
+        request.thumbSize = thumbSize;
+        request.layout = Settings::thumbsLayout;
+        request.usePackedStore = Settings::thumbsPackedStore;
+        request.lastModified = fileInfo.lastModified();
+        request.fileSize = fileInfo.size();
+        request.readOrientation = Settings::exifThumbRotationEnabled;
+        requests.append(request);
+    }
+
+    // Storing the thumbnails is the whole point, so the decoders wait for the writer
+    ThumbnailWriter::setBlocking(true);
+
+    QElapsedTimer timer;
+    timer.start();
+    std::atomic<int> failed(0);
+    const ThumbnailRequest *requestData = requests.constData();
+    forEachOnAllCores(requests.size(), [&](int index) {
+        if (!ThumbnailLoader::loadThumbnail(requestData[index]).ok) {
+            failed++;
+        }
+    });
+    ThumbnailWriter::waitForDone();
+    failed += ThumbnailWriter::failedWrites();
+
+    reportThroughput(QStringLiteral("Thumbnails"), requests.size(), failed, timer);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int findDuplicates(const QFileInfoList &fileInfos, bool json)
+{
+    QElapsedTimer timer;
+    timer.start();
+    DuplicateFinder duplicateFinder;
+    duplicateFinder.reset(ImageHash::Method(Settings::duplicateHashMethod),
+                          Settings::duplicateHashDistance);
+    if (Settings::exactDuplicatesOnly) {
+        duplicateFinder.addIdenticalFiles(fileInfos, {}, {});
+    } else {
+        duplicateFinder.addImages(fileInfos, {}, {});
+    }
+
+    QTextStream out(stdout);
+    if (json) {
+        QJsonArray groups;
+        for (const DuplicateImage &image : duplicateFinder.groups()) {
+            if (!image.duplicatePaths.isEmpty()) {
+                QJsonObject group;
+                group.insert(QStringLiteral("original"), image.filePath);
+                group.insert(QStringLiteral("duplicates"),
+                             QJsonArray::fromStringList(image.duplicatePaths));
+                groups.append(group);
+            }
+        }
+        out << QJsonDocument(groups).toJson();
+    } else {
+        for (const DuplicateImage &image : duplicateFinder.groups()) {
+            if (!image.duplicatePaths.isEmpty()) {
+                out << image.filePath << '\n';
+                for (const QString &duplicatePath : image.duplicatePaths) {
+                    out << '\t' << duplicatePath << '\n';
+                }
+            }
+        }
+    }
+    out.flush();
+
+    reportThroughput(QStringLiteral("Duplicates"), fileInfos.size(), 0, timer);
+    QTextStream(stderr) << duplicateFinder.duplicateCount() << " duplicates of "
+                        << duplicateFinder.originalCount() << " images" << Qt::endl;
+    return EXIT_SUCCESS;
+}
+
+// Copies the metadata like ImageViewer::saveImage() does, without the stale EXIF thumbnail
+void copyMetadata(const QString &sourcePath, const QString &targetPath)
+{
+    try {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+        Exiv2::Image::AutoPtr sourceImage = Exiv2::ImageFactory::open(sourcePath.toStdString());
+        Exiv2::Image::AutoPtr targetImage = Exiv2::ImageFactory::open(targetPath.toStdString());
+#pragma clang diagnostic pop
+        sourceImage->readMetadata();
+        targetImage->setMetadata(*sourceImage);
+        Exiv2::ExifThumb thumb(targetImage->exifData());
+        thumb.erase();
+        targetImage->writeMetadata();
+    } catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+    }
+}
+
+bool transformImage(const QString &sourcePath, const QString &targetPath)
+{
+    // The pixels stay in the orientation they are stored in, the EXIF orientation is copied
+    QImageReader imageReader(sourcePath);
+    const QByteArray format = imageReader.format().toUpper();
+    QImage image;
+    if (!imageReader.read(&image)) {
+        qWarning() << "Failed to read" << sourcePath << imageReader.errorString();
+        return false;
+    }
+
+    image = ImageViewer::transformImage(image);
+    if (!image.save(targetPath, format.constData(), Settings::defaultSaveQuality)) {
+        qWarning() << "Failed to save" << targetPath;
+        return false;
+    }
+
+    copyMetadata(sourcePath, targetPath);
+    return true;
+}
+
+int batchTransform(const QString &directory, const QFileInfoList &fileInfos,
+                   const QString &outputDirectory)
+{
+    const QDir rootDir(directory);
+    const QDir outputDir(outputDirectory);
+    if (QFileInfo(outputDirectory).canonicalFilePath() == rootDir.canonicalPath()) {
+        QTextStream(stderr) << "The output directory has to differ from " << directory
+                            << Qt::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Images from sub-directories keep their relative path, so equal names can not collide
+    QStringList sourcePaths;
+    QStringList targetPaths;
+    QSet<QString> targetDirectories;
+    for (const QFileInfo &fileInfo : fileInfos) {
+        const QString targetPath =
+            outputDir.filePath(rootDir.relativeFilePath(fileInfo.filePath()));
+        const QString targetDirectory = QFileInfo(targetPath).absolutePath();
+        if (!targetDirectories.contains(targetDirectory)) {
+            if (!QDir().mkpath(targetDirectory)) {
+                QTextStream(stderr) << "Failed to create " << targetDirectory << Qt::endl;
+                return EXIT_FAILURE;
+            }
+            targetDirectories.insert(targetDirectory);
+        }
+        sourcePaths.append(fileInfo.filePath());
+        targetPaths.append(targetPath);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::atomic<int> failed(0);
+    forEachOnAllCores(sourcePaths.size(), [&](int index) {
+        if (!transformImage(sourcePaths.at(index), targetPaths.at(index))) {
+            failed++;
+        }
+    });
+
+    reportThroughput(QStringLiteral("Transformed"), sourcePaths.size(), failed, timer);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+} // namespace
+
+namespace BatchMode {
+
+bool isRequested(int argc, char *argv[])
+{
+    const char *const commands[] = {generateThumbnailsCommand, findDuplicatesCommand,
+                                    batchTransformCommand};
+    for (int i = 1; i < argc; ++i) {
+        const QByteArray argument(argv[i]);
+        for (const char *command : commands) {
+            const QByteArray option = QByteArray("--") + command;
+            if (argument == option || argument.startsWith(option + '=')) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int run(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(VERSION " batch mode.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    const QString directoryName = QCoreApplication::translate("main", "directory");
+    QCommandLineOption generateThumbnailsOption(
+        QLatin1String(generateThumbnailsCommand),
+        QCoreApplication::translate("main",
+                                    "Generate the thumbnails of all images in <directory>."),
+        directoryName);
+    parser.addOption(generateThumbnailsOption);
+
+    QCommandLineOption findDuplicatesOption(
+        QLatin1String(findDuplicatesCommand),
+        QCoreApplication::translate("main", "List the duplicate images in <directory>."),
+        directoryName);
+    parser.addOption(findDuplicatesOption);
+
+    QCommandLineOption batchTransformOption(
+        QLatin1String(batchTransformCommand),
+        QCoreApplication::translate(
+            "main", "Rotate and crop all images in <directory> into the output directory."),
+        directoryName);
+    parser.addOption(batchTransformOption);
+
+    QCommandLineOption recursiveOption(
+        QStringList() << QStringLiteral("r") << QStringLiteral("recursive"),
+        QCoreApplication::translate("main", "Include the images in sub-directories."));
+    parser.addOption(recursiveOption);
+
+    QCommandLineOption jsonOption(
+        QStringLiteral("json"),
+        QCoreApplication::translate("main", "List the duplicates as JSON."));
+    parser.addOption(jsonOption);
+
+    QCommandLineOption targetDirectoryOption(
+        QStringList() << QStringLiteral("o") << QStringLiteral("output-directory"),
+        QCoreApplication::translate("main", "Save the transformed images into <directory>."),
+        directoryName);
+    parser.addOption(targetDirectoryOption);
+
+    QCommandLineOption rotateOption(
+        QStringLiteral("rotate"),
+        QCoreApplication::translate("main", "Rotate the images clockwise by <degrees>."),
+        QCoreApplication::translate("main", "degrees"));
+    parser.addOption(rotateOption);
+
+    QCommandLineOption cropOption(
+        QStringLiteral("crop"),
+        QCoreApplication::translate(
+            "main", "Cut the given number of pixels off the left, top, right and bottom."),
+        QCoreApplication::translate("main", "left,top,right,bottom"));
+    parser.addOption(cropOption);
+
+    QCommandLineOption pipelineStatsOption(
+        QStringLiteral("pipeline-stats"),
+        QCoreApplication::translate("main",
+                                    "Write thumbnail pipeline statistics to <file> on exit."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(pipelineStatsOption);
+
+    QCommandLineOption traceOption(
+        QStringLiteral("trace"),
+        QCoreApplication::translate("main", "Record a trace of the image loading into <file>."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(traceOption);
+
+    parser.process(application);
+
+    // Written by main() once the application is gone
+    if (parser.isSet(traceOption)) {
+        Trace::start(parser.value(traceOption));
+    } else {
+        Trace::startFromEnvironment();
+    }
+
+    const auto writePipelineStats = qScopeGuard([&parser, &pipelineStatsOption] {
+        if (parser.isSet(pipelineStatsOption)) {
+            PipelineStats::writeJson(parser.value(pipelineStatsOption));
+        }
+    });
+
+    const int commands = int(parser.isSet(generateThumbnailsOption))
+        + int(parser.isSet(findDuplicatesOption)) + int(parser.isSet(batchTransformOption));
+    if (commands != 1) {
+        QTextStream(stderr) << "Only one batch command can be run at a time" << Qt::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Not thread safe, so it has to happen before the workers start reading metadata, like the
+    // ThumbnailLoader constructor does for the GUI
+    Exiv2::XmpParser::initialize();
+
+    readSettings();
+
+    if (parser.isSet(batchTransformOption)) {
+        if (!parser.isSet(targetDirectoryOption)) {
+            QTextStream(stderr) << "--batch-transform needs an --output-directory" << Qt::endl;
+            return EXIT_FAILURE;
+        }
+
+        bool ok = true;
+        if (parser.isSet(rotateOption)) {
+            Settings::rotation = parser.value(rotateOption).toDouble(&ok);
+        }
+        if (ok && parser.isSet(cropOption)) {
+            const QStringList margins = parser.value(cropOption).split(QLatin1Char(','));
+            ok = margins.size() == 4;
+            int *cropSettings[] = {&Settings::cropLeft, &Settings::cropTop, &Settings::cropWidth,
+                                   &Settings::cropHeight};
+            for (int i = 0; ok && i < 4; ++i) {
+                *cropSettings[i] = margins.at(i).toInt(&ok);
+                ok = ok && *cropSettings[i] >= 0;
+            }
+        }
+        if (!ok) {
+            QTextStream(stderr) << "Invalid --rotate or --crop value" << Qt::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    QString directory;
+    for (const QCommandLineOption &option :
+         {generateThumbnailsOption, findDuplicatesOption, batchTransformOption}) {
+        if (parser.isSet(option)) {
+            directory = parser.value(option);
+        }
+    }
+    if (!QFileInfo(directory).isDir()) {
+        QTextStream(stderr) << directory << " is not a directory" << Qt::endl;
+        return EXIT_FAILURE;
+    }
+
+    const QFileInfoList fileInfos = findImages(directory, parser.isSet(recursiveOption));
+    if (parser.isSet(generateThumbnailsOption)) {
+        return generateThumbnails(fileInfos);
+    }
+    if (parser.isSet(findDuplicatesOption)) {
+        return findDuplicates(fileInfos, parser.isSet(jsonOption));
+    }
+    return batchTransform(directory, fileInfos, parser.value(targetDirectoryOption));
+}
+}
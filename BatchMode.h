@@ -0,0 +1,38 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Runs the thumbnail, duplicate and transform jobs of the image viewer from the command line,
+// without a display and without creating any widgets:
+//
+//   phototonic --generate-thumbnails DIR
+//   phototonic --find-duplicates DIR [--json]
+//   phototonic --batch-transform DIR --output-directory OUT [--rotate DEG] [--crop L,T,R,B]
+//
+// Settings like the thumbnail size, the thumbnail store and the duplicate hash method are taken
+// from the configuration the viewer saved. The work is spread over all cores and the throughput
+// is reported on stderr when done, results go to stdout.
+namespace BatchMode {
+
+// Tells whether the arguments ask for one of the batch commands
+bool isRequested(int argc, char *argv[]);
+
+// Creates its own QCoreApplication, so it has to be called instead of starting the viewer.
+// Returns the exit code of the process.
+int run(int argc, char *argv[]);
+}
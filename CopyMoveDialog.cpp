@@ -25,7 +25,6 @@
 #include <QFile>
 #include <QHBoxLayout>
 #include <QPushButton>
-#include <QStandardItemModel>
 
 #include <limits>
 
@@ -130,9 +129,8 @@ void CopyMoveDialog::execute(ThumbsViewer *thumbView, const QString &destDir, bo
     } else {
         QList<int> rowList;
         for (tn = Settings::copyCutIndexList.size() - 1; tn >= 0; --tn) {
-            sourceFile = thumbView->thumbsViewerModel->item(Settings::copyCutIndexList[tn].row())
-                             ->data(thumbView->FileNameRole)
-                             .toString();
+            sourceFile =
+                thumbView->thumbsViewerModel->filePath(Settings::copyCutIndexList[tn].row());
             fileInfo = QFileInfo(sourceFile);
             currFile = fileInfo.fileName();
             destFile = destDir + QDir::separator() + currFile;
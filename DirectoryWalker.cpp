@@ -0,0 +1,237 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DirectoryWalker.h"
+#include "PipelineStats.h"
+
+#include <QDirIterator>
+#include <QImageReader>
+#include <QMimeDatabase>
+#include <QRunnable>
+
+FileNameFilter::FileNameFilter(const QStringList &nameFilters)
+{
+    for (const QString &nameFilter : nameFilters) {
+        QString suffix = nameFilter;
+        while (suffix.startsWith(QLatin1Char('*'))) {
+            suffix.remove(0, 1);
+        }
+
+        if (suffix.startsWith(QLatin1Char('.')) && !suffix.contains(QLatin1Char('*'))
+            && !suffix.contains(QLatin1Char('?')) && !suffix.contains(QLatin1Char('['))) {
+            suffixes.insert(suffix.toLower());
+        } else {
+            patterns.append(
+                QRegularExpression(QRegularExpression::wildcardToRegularExpression(nameFilter),
+                                   QRegularExpression::CaseInsensitiveOption));
+        }
+    }
+}
+
+const QStringList &FileNameFilter::imageNameFilters()
+{
+    static const QStringList imageTypeGlobs = [] {
+        QStringList globs;
+        QMimeDatabase db;
+        const auto &localSupportedMimeTypes = QImageReader::supportedMimeTypes();
+        for (const QByteArray &type : localSupportedMimeTypes) {
+            globs.append(db.mimeTypeForName(type).globPatterns());
+        }
+        return globs;
+    }();
+    return imageTypeGlobs;
+}
+
+bool FileNameFilter::matches(const QString &fileName) const
+{
+    for (int dot = fileName.indexOf(QLatin1Char('.')); dot >= 0;
+         dot = fileName.indexOf(QLatin1Char('.'), dot + 1)) {
+        if (suffixes.contains(fileName.mid(dot).toLower())) {
+            return true;
+        }
+    }
+
+    for (const QRegularExpression &pattern : patterns) {
+        if (pattern.match(fileName).hasMatch()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class DirectoryWalker::Worker : public QRunnable {
+public:
+    Worker(DirectoryWalker *walker, int workerIndex)
+        : walker(walker)
+        , workerIndex(workerIndex)
+    {
+    }
+
+    void run() override
+    {
+        walker->work(workerIndex);
+    }
+
+private:
+    DirectoryWalker *walker;
+    int workerIndex;
+};
+
+DirectoryWalker::DirectoryWalker(const QString &rootPath, QDir::Filters filters,
+                                 const QStringList &nameFilters, int maxThreads)
+    : rootPath(rootPath)
+    , filters(filters)
+    , fileNameFilter(nameFilters)
+{
+    threadPool.setMaxThreadCount(qMax(1, maxThreads));
+    for (int i = 0; i < threadPool.maxThreadCount(); ++i) {
+        workQueues.push_back(std::make_unique<WorkQueue>());
+    }
+}
+
+DirectoryWalker::~DirectoryWalker()
+{
+    cancel();
+    threadPool.waitForDone();
+}
+
+void DirectoryWalker::start()
+{
+    pendingDirectories = 1;
+    workQueues.front()->directories.push_back(rootPath);
+
+    activeWorkers = int(workQueues.size());
+    for (int i = 0; i < activeWorkers; ++i) {
+        threadPool.start(new Worker(this, i));
+    }
+}
+
+void DirectoryWalker::cancel()
+{
+    isCancelled = 1;
+    QMutexLocker locker(&workMutex);
+    workAvailable.wakeAll();
+}
+
+bool DirectoryWalker::takeListings(QVector<DirectoryListing> *listings, int timeout)
+{
+    QMutexLocker locker(&listingsMutex);
+    if (finishedListings.isEmpty() && activeWorkers > 0) {
+        listingsAvailable.wait(&listingsMutex, timeout);
+    }
+
+    listings->swap(finishedListings);
+    finishedListings.clear();
+    return !listings->isEmpty() || activeWorkers > 0;
+}
+
+void DirectoryWalker::work(int workerIndex)
+{
+    QString directory;
+    while (nextDirectory(workerIndex, &directory)) {
+        if (!isCancelled) {
+            listDirectory(workerIndex, directory);
+        }
+
+        if (pendingDirectories.fetchAndAddOrdered(-1) == 1) {
+            // That was the last one, let the idle workers know
+            QMutexLocker locker(&workMutex);
+            workAvailable.wakeAll();
+        }
+    }
+
+    QMutexLocker locker(&listingsMutex);
+    --activeWorkers;
+    listingsAvailable.wakeAll();
+}
+
+bool DirectoryWalker::nextDirectory(int workerIndex, QString *directory)
+{
+    const int workers = int(workQueues.size());
+    forever {
+        // Depth first on the own stack keeps the disk heads near, stealing takes the oldest
+        // entries of the others, which tend to be the biggest subtrees
+        for (int i = 0; i < workers; ++i) {
+            WorkQueue &workQueue = *workQueues[(workerIndex + i) % workers];
+            QMutexLocker locker(&workQueue.mutex);
+            if (workQueue.directories.empty()) {
+                continue;
+            }
+
+            if (i == 0) {
+                *directory = workQueue.directories.back();
+                workQueue.directories.pop_back();
+            } else {
+                *directory = workQueue.directories.front();
+                workQueue.directories.pop_front();
+            }
+            return true;
+        }
+
+        QMutexLocker locker(&workMutex);
+        if (pendingDirectories == 0) {
+            return false;
+        }
+        // New directories wake us up, the timeout covers the ones queued before we got here
+        workAvailable.wait(&workMutex, 10);
+    }
+}
+
+void DirectoryWalker::listDirectory(int workerIndex, const QString &directory)
+{
+    PipelineStats::ScopedTimer timer(PipelineStats::ListDirectory);
+    QDirIterator dirIterator(directory, (filters & QDir::Hidden) | QDir::Files | QDir::Dirs
+                                            | QDir::NoDotAndDotDot);
+    DirectoryListing listing;
+    listing.path = directory;
+    QStringList subdirectories;
+
+    while (dirIterator.hasNext()) {
+        dirIterator.next();
+        const QFileInfo fileInfo = dirIterator.fileInfo();
+        if (fileInfo.isDir()) {
+            if (!fileInfo.isSymLink()) {
+                subdirectories.append(fileInfo.filePath());
+            }
+        } else if (directory != rootPath && fileNameFilter.matches(fileInfo.fileName())) {
+            // Fills the stat() cache of the QFileInfo here instead of on the GUI thread
+            fileInfo.size();
+            listing.fileInfos.append(fileInfo);
+        }
+    }
+
+    if (!subdirectories.isEmpty()) {
+        pendingDirectories.fetchAndAddOrdered(subdirectories.size());
+        {
+            WorkQueue &workQueue = *workQueues[workerIndex];
+            QMutexLocker locker(&workQueue.mutex);
+            for (const QString &subdirectory : qAsConst(subdirectories)) {
+                workQueue.directories.push_back(subdirectory);
+            }
+        }
+
+        QMutexLocker locker(&workMutex);
+        workAvailable.wakeAll();
+    }
+
+    if (directory != rootPath) {
+        QMutexLocker locker(&listingsMutex);
+        finishedListings.append(listing);
+        listingsAvailable.wakeAll();
+    }
+}
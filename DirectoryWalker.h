@@ -0,0 +1,110 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFileInfoList>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Matches file names against QDir style name filters, case insensitive like QDir does. Plain
+// "*.ext" patterns, which is all of them without a text filter, become a lookup in a hash.
+class FileNameFilter {
+public:
+    explicit FileNameFilter(const QStringList &nameFilters);
+
+    [[nodiscard]] bool matches(const QString &fileName) const;
+
+    // Glob patterns of all the formats QImageReader can read
+    [[nodiscard]] static const QStringList &imageNameFilters();
+
+private:
+    QSet<QString> suffixes;
+    QVector<QRegularExpression> patterns;
+};
+
+struct DirectoryListing
+{
+    QString path;
+    // Already stat()ed, so asking for their size or time does not touch the disk again
+    QFileInfoList fileInfos;
+};
+
+// Lists all directories below a root directory on a pool of worker threads. Every worker keeps
+// its own stack of directories still to be listed and steals from the others when it runs dry.
+// Symbolic links to directories are not followed. Listings are collected by takeListings(), one
+// for every directory below the root, including the ones without any matching files.
+class DirectoryWalker {
+public:
+    // Files are picked by filters and nameFilters like QDir does, maxThreads limits the number
+    // of directories being read at the same time
+    DirectoryWalker(const QString &rootPath, QDir::Filters filters, const QStringList &nameFilters,
+                    int maxThreads);
+
+    // Cancels the walk and waits for the workers
+    ~DirectoryWalker();
+
+    void start();
+
+    // Stops listing new directories, the ones being listed still show up in takeListings()
+    void cancel();
+
+    // Waits up to timeout milliseconds for listings and moves all finished ones to listings.
+    // Returns false once the walk is over and there is nothing left to take.
+    bool takeListings(QVector<DirectoryListing> *listings, int timeout);
+
+private:
+    class Worker;
+
+    struct WorkQueue
+    {
+        QMutex mutex;
+        std::deque<QString> directories;
+    };
+
+    void work(int workerIndex);
+
+    bool nextDirectory(int workerIndex, QString *directory);
+
+    void listDirectory(int workerIndex, const QString &directory);
+
+    QString rootPath;
+    QDir::Filters filters;
+    FileNameFilter fileNameFilter;
+    QThreadPool threadPool;
+    std::vector<std::unique_ptr<WorkQueue>> workQueues;
+    // Directories queued or being listed, the walk is over when this drops to zero
+    QAtomicInt pendingDirectories;
+    QAtomicInt isCancelled;
+    QMutex workMutex;
+    QWaitCondition workAvailable;
+
+    QMutex listingsMutex;
+    QWaitCondition listingsAvailable;
+    QVector<DirectoryListing> finishedListings;
+    int activeWorkers = 0;
+};
@@ -0,0 +1,248 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DuplicateFinder.h"
+#include "FileHash.h"
+#include "ImageFeatureStore.h"
+#include "Parallel.h"
+
+#include <QHash>
+#include <QPair>
+#include <QThread>
+
+#include <vector>
+
+void DuplicateFinder::reset(ImageHash::Method method, int maxDistance)
+{
+    this->method = method;
+    this->maxDistance = maxDistance;
+    images.clear();
+    imageIndex.clear();
+    scanned = originals = duplicates = 0;
+}
+
+int DuplicateFinder::chunkSize()
+{
+    // Small enough for the caller to stay responsive, large enough to keep all cores busy
+    return QThread::idealThreadCount() * 10;
+}
+
+int DuplicateFinder::addGroup(const QString &filePath)
+{
+    DuplicateImage image;
+    image.filePath = filePath;
+    images.append(image);
+    return images.size() - 1;
+}
+
+void DuplicateFinder::addDuplicate(int id, const QString &filePath,
+                                   const DuplicateFound &duplicateFound)
+{
+    DuplicateImage &original = images[id];
+    if (original.duplicatePaths.isEmpty()) {
+        originals++;
+    }
+    duplicates++;
+    original.duplicatePaths.append(filePath);
+    if (duplicateFound) {
+        duplicateFound(id);
+    }
+}
+
+bool DuplicateFinder::addImages(const QFileInfoList &fileInfos,
+                                const DuplicateFound &duplicateFound, const Progress &progress)
+{
+    const int chunkSize = DuplicateFinder::chunkSize();
+    std::vector<quint64> imageHashes(chunkSize);
+    std::vector<char> hashed(chunkSize);
+    QStringList filePaths;
+    QVector<int> unknownHashes;
+    for (int chunkBegin = 0; chunkBegin < fileInfos.size(); chunkBegin += chunkSize) {
+        const int chunkEnd = qMin(chunkBegin + chunkSize, fileInfos.size());
+
+        // Hashes from earlier scans are taken as they are. QFileInfo caches lazily and is only
+        // used on this thread, the workers get the paths.
+        filePaths.clear();
+        unknownHashes.clear();
+        for (int i = chunkBegin; i < chunkEnd; ++i) {
+            const QFileInfo &fileInfo = fileInfos.at(i);
+            filePaths.append(fileInfo.absoluteFilePath());
+            hashed[i - chunkBegin] =
+                ImageFeatureStore::forDirectory(fileInfo.absolutePath())
+                    ->findImageHash(filePaths.last(), fileInfo.lastModified(), fileInfo.size(),
+                                    method, &imageHashes[i - chunkBegin]);
+            if (!hashed[i - chunkBegin]) {
+                unknownHashes.append(i - chunkBegin);
+            }
+        }
+
+        Parallel::forChunks(unknownHashes.size(), 1, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                const int index = unknownHashes.at(i);
+                hashed[index] = ImageHash::read(filePaths.at(index), method, &imageHashes[index]);
+            }
+        });
+
+        for (const int index : qAsConst(unknownHashes)) {
+            if (hashed[index]) {
+                const QFileInfo &fileInfo = fileInfos.at(chunkBegin + index);
+                ImageFeatureStore::forDirectory(fileInfo.absolutePath())
+                    ->insertImageHash(filePaths.at(index), fileInfo.lastModified(),
+                                      fileInfo.size(), method, imageHashes[index]);
+            }
+        }
+
+        // Grouped in the original order, so the result does not depend on the thread count
+        for (int i = 0; i < chunkEnd - chunkBegin; ++i) {
+            if (!hashed[i]) {
+                continue;
+            }
+
+            scanned++;
+            const int id = imageIndex.findNearest(imageHashes[i], maxDistance);
+            if (id >= 0) {
+                addDuplicate(id, fileInfos.at(chunkBegin + i).filePath(), duplicateFound);
+            } else {
+                imageIndex.insert(imageHashes[i], images.size());
+                addGroup(fileInfos.at(chunkBegin + i).filePath());
+            }
+        }
+
+        if (progress && !progress()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DuplicateFinder::hashFiles(const QStringList &filePaths, const QVector<int> &indices,
+                                qint64 maxBytes, QVector<quint64> *hashes,
+                                const Progress &progress)
+{
+    // Taken once, detaching the vector from several threads would be a race
+    quint64 *hashData = hashes->data();
+    const int chunkSize = DuplicateFinder::chunkSize();
+    for (int chunkBegin = 0; chunkBegin < indices.size(); chunkBegin += chunkSize) {
+        const int chunkEnd = qMin(chunkBegin + chunkSize, indices.size());
+        Parallel::forChunks(chunkEnd - chunkBegin, 1, [&](int begin, int end) {
+            for (int i = chunkBegin + begin; i < chunkBegin + end; ++i) {
+                const int index = indices.at(i);
+                if (!FileHash::hashFile(filePaths.at(index), maxBytes, hashData + index)) {
+                    // Unreadable files must not match each other
+                    hashData[index] = ~quint64(index);
+                }
+            }
+        });
+
+        if (progress && !progress()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DuplicateFinder::addIdenticalFiles(const QFileInfoList &fileInfos,
+                                        const DuplicateFound &duplicateFound,
+                                        const Progress &progress)
+{
+    scanned += fileInfos.size();
+
+    // Most files have a size of their own and are never read. The others are told apart by the
+    // start of the file first, and only read in full if that is the same too. Empty files are
+    // no images and left out.
+    const qint64 prefixSize = 64 * 1024;
+    QHash<qint64, int> filesOfSize;
+    for (const QFileInfo &fileInfo : fileInfos) {
+        ++filesOfSize[fileInfo.size()];
+    }
+
+    // The hashing threads get the paths, QFileInfo caches lazily and is not safe to share
+    QVector<int> candidates;
+    QStringList filePaths;
+    for (int i = 0; i < fileInfos.size(); ++i) {
+        if (fileInfos.at(i).size() > 0 && filesOfSize.value(fileInfos.at(i).size()) > 1) {
+            candidates.append(i);
+            filePaths.append(fileInfos.at(i).absoluteFilePath());
+        } else {
+            filePaths.append(QString());
+        }
+    }
+
+    QVector<quint64> prefixHashes(fileInfos.size());
+    if (!hashFiles(filePaths, candidates, prefixSize, &prefixHashes, progress)) {
+        return false;
+    }
+
+    QHash<QPair<qint64, quint64>, int> filesOfPrefix;
+    for (const int i : qAsConst(candidates)) {
+        ++filesOfPrefix[qMakePair(fileInfos.at(i).size(), prefixHashes.at(i))];
+    }
+
+    QVector<int> fullCandidates;
+    QVector<int> matchingCandidates;
+    for (const int i : qAsConst(candidates)) {
+        if (filesOfPrefix.value(qMakePair(fileInfos.at(i).size(), prefixHashes.at(i))) > 1) {
+            matchingCandidates.append(i);
+            if (fileInfos.at(i).size() > prefixSize) {
+                fullCandidates.append(i);
+            }
+        }
+    }
+
+    // Files no larger than the prefix have been hashed in full already
+    QVector<quint64> hashes = prefixHashes;
+    if (!hashFiles(filePaths, fullCandidates, -1, &hashes, progress)) {
+        return false;
+    }
+
+    QHash<QPair<qint64, quint64>, int> groupIds;
+    for (const int i : qAsConst(matchingCandidates)) {
+        const QPair<qint64, quint64> key = qMakePair(fileInfos.at(i).size(), hashes.at(i));
+        const auto found = groupIds.constFind(key);
+        if (found != groupIds.constEnd()) {
+            addDuplicate(found.value(), fileInfos.at(i).filePath(), duplicateFound);
+        } else {
+            groupIds.insert(key, addGroup(fileInfos.at(i).filePath()));
+        }
+    }
+    return true;
+}
+
+const DuplicateImage &DuplicateFinder::group(int id) const
+{
+    return images.at(id);
+}
+
+const QVector<DuplicateImage> &DuplicateFinder::groups() const
+{
+    return images;
+}
+
+int DuplicateFinder::scannedFiles() const
+{
+    return scanned;
+}
+
+int DuplicateFinder::originalCount() const
+{
+    return originals;
+}
+
+int DuplicateFinder::duplicateCount() const
+{
+    return duplicates;
+}
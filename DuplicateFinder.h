@@ -0,0 +1,91 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ImageHash.h"
+#include "ImageHashIndex.h"
+
+#include <QFileInfoList>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+struct DuplicateImage
+{
+    QString filePath;
+    // The images found to be duplicates of this one, in the order they were found
+    QStringList duplicatePaths;
+};
+
+// Sorts images into groups of duplicates, each headed by the first image of the group found.
+// Images either count as duplicates when their image hashes are close enough, or only when the
+// files are identical. Files are hashed on all cores a chunk at a time, the caller gets control
+// back between chunks. No widgets are involved, so this also runs without a display.
+class DuplicateFinder {
+public:
+    // Gets the id of the group a duplicate has just been added to
+    using DuplicateFound = std::function<void(int id)>;
+    // Called after every chunk, the search is abandoned when it returns false
+    using Progress = std::function<bool()>;
+
+    // Forgets all groups, the next images are compared by the given hash method and distance
+    void reset(ImageHash::Method method, int maxDistance);
+
+    // Hashes the images, with the hashes of unchanged images taken from the ImageFeatureStore,
+    // and sorts them into the groups in order. Returns false if abandoned.
+    bool addImages(const QFileInfoList &fileInfos, const DuplicateFound &duplicateFound,
+                   const Progress &progress);
+
+    // Groups the files with identical contents. Only files of the same size can be identical, so
+    // unlike addImages() this has to see all files at once. Returns false if abandoned.
+    bool addIdenticalFiles(const QFileInfoList &fileInfos, const DuplicateFound &duplicateFound,
+                           const Progress &progress);
+
+    [[nodiscard]] const DuplicateImage &group(int id) const;
+
+    // All groups, including the ones without duplicates
+    [[nodiscard]] const QVector<DuplicateImage> &groups() const;
+
+    [[nodiscard]] int scannedFiles() const;
+
+    // Groups with at least one duplicate
+    [[nodiscard]] int originalCount() const;
+
+    [[nodiscard]] int duplicateCount() const;
+
+private:
+    // Hashes the files at the given indices into the same indices of hashes
+    bool hashFiles(const QStringList &filePaths, const QVector<int> &indices, qint64 maxBytes,
+                   QVector<quint64> *hashes, const Progress &progress);
+
+    // Returns the id of the new group
+    int addGroup(const QString &filePath);
+
+    void addDuplicate(int id, const QString &filePath, const DuplicateFound &duplicateFound);
+
+    static int chunkSize();
+
+    ImageHash::Method method = ImageHash::DifferenceHash;
+    int maxDistance = 0;
+    QVector<DuplicateImage> images;
+    ImageHashIndex imageIndex;
+    int scanned = 0;
+    int originals = 0;
+    int duplicates = 0;
+};
@@ -0,0 +1,113 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileHash.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QtEndian>
+
+#include <cstring>
+#include <limits>
+
+namespace { // anonymous, not visible outside of this file
+const quint64 prime1 = 0x9e3779b185ebca87ULL;
+const quint64 prime2 = 0xc2b2ae3d27d4eb4fULL;
+
+// A multiply and a rotation per 8 bytes keep up with any disk, the final mix spreads the
+// remaining structure over all bits
+class Hasher {
+public:
+    // Expects multiples of 8 bytes, except for the last call
+    void add(const char *data, qint64 size)
+    {
+        const char *end = data + (size & ~qint64(7));
+        for (; data < end; data += 8) {
+            state = rotateLeft(state ^ (qFromLittleEndian<quint64>(data) * prime2), 31) * prime1;
+        }
+
+        if (size & 7) {
+            quint64 tail = 0;
+            std::memcpy(&tail, end, size_t(size & 7));
+            state = rotateLeft(state ^ (qFromLittleEndian(tail) * prime2), 31) * prime1;
+        }
+        length += size;
+    }
+
+    quint64 result() const
+    {
+        quint64 value = state ^ quint64(length);
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+
+private:
+    static quint64 rotateLeft(quint64 value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    quint64 state = prime1;
+    qint64 length = 0;
+};
+}
+
+namespace FileHash {
+
+bool hashFile(const QString &filePath, qint64 maxBytes, quint64 *hash)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot read" << filePath << file.errorString();
+        return false;
+    }
+
+    const qint64 blockSize = 1 << 20;
+    QByteArray block(int(blockSize), Qt::Uninitialized);
+    qint64 remaining = maxBytes < 0 ? std::numeric_limits<qint64>::max() : maxBytes;
+    Hasher hasher;
+    while (remaining > 0) {
+        // Only the last block may be cut short, the hasher needs whole words before that
+        const qint64 wanted = qMin(remaining, blockSize);
+        qint64 size = 0;
+        while (size < wanted) {
+            const qint64 read = file.read(block.data() + size, wanted - size);
+            if (read < 0) {
+                qWarning() << "Cannot read" << filePath << file.errorString();
+                return false;
+            }
+            if (read == 0) {
+                break;
+            }
+            size += read;
+        }
+
+        hasher.add(block.constData(), size);
+        remaining -= size;
+        if (size < wanted) {
+            break;
+        }
+    }
+
+    *hash = hasher.result();
+    return true;
+}
+}
@@ -0,0 +1,30 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QtGlobal>
+
+// Fast 64 bit hashes of file contents, to tell identical files apart from different ones. Not
+// cryptographic, so not meant for anything where a collision could be crafted.
+namespace FileHash {
+
+// Hashes the first maxBytes of the file, or all of it if maxBytes is negative. Returns false if
+// the file cannot be read.
+bool hashFile(const QString &filePath, qint64 maxBytes, quint64 *hash);
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2013 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Histogram.h"
+
+#include <QDebug>
+
+Histogram Histogram::fromImage(const QImage &img, qreal *brightness)
+{
+    Histogram hist;
+    if (brightness != nullptr) {
+        *brightness = 0;
+    }
+    if (img.isNull()) {
+        qWarning() << "Invalid file";
+        return hist;
+    }
+
+    const QImage image =
+        img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32
+        ? img
+        : img.convertToFormat(QImage::Format_ARGB32);
+    const int width = image.width();
+    const int height = image.height();
+
+    // Every step-th pixel of every step-th line, which keeps the counts below 65536
+    int step = 1;
+    while (qint64((width + step - 1) / step) * ((height + step - 1) / step) > 65535) {
+        ++step;
+    }
+
+    // Four sets of bins, so runs of equally colored pixels do not wait for each other's
+    // increments. The scattered increments can not be vectorized, this is what keeps them fast.
+    quint32 bins[4][3][256] = {};
+    for (int y = 0; y < height; y += step) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        int x = 0;
+        for (; x + 3 * step < width; x += 4 * step) {
+            for (int lane = 0; lane < 4; ++lane) {
+                const QRgb pixel = line[x + lane * step];
+                ++bins[lane][0][qRed(pixel)];
+                ++bins[lane][1][qGreen(pixel)];
+                ++bins[lane][2][qBlue(pixel)];
+            }
+        }
+        for (; x < width; x += step) {
+            const QRgb pixel = line[x];
+            ++bins[0][0][qRed(pixel)];
+            ++bins[0][1][qGreen(pixel)];
+            ++bins[0][2][qBlue(pixel)];
+        }
+    }
+
+    quint64 pixels = 0;
+    quint64 sums[3] = {};
+    for (int i = 0; i < 256; ++i) {
+        quint32 counts[3];
+        for (int channel = 0; channel < 3; ++channel) {
+            counts[channel] = bins[0][channel][i] + bins[1][channel][i] + bins[2][channel][i]
+                + bins[3][channel][i];
+            sums[channel] += quint64(counts[channel]) * i;
+        }
+        hist.red[i] = quint16(counts[0]);
+        hist.green[i] = quint16(counts[1]);
+        hist.blue[i] = quint16(counts[2]);
+        pixels += counts[0];
+    }
+
+    if (brightness != nullptr && pixels > 0) {
+        // The weights of qGray(), applied to the average color
+        *brightness = (11.0 * sums[0] + 16.0 * sums[1] + 5.0 * sums[2]) / (32.0 * 255.0 * pixels);
+    }
+
+    return hist;
+}
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2013 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QMetaType>
+
+#include <cmath>
+
+// Color distribution of an image. At most 65535 pixels are counted, so the bins fit 16 bits.
+struct Histogram
+{
+    quint16 red[256]{};
+    quint16 green[256]{};
+    quint16 blue[256]{};
+
+    static inline float compareChannel(const quint16 hist1[256], const quint16 hist2[256])
+    {
+        float len1 = 0.F, len2 = 0.F, corr = 0.F;
+
+        for (uint16_t i = 0; i < 256; i++) {
+            len1 += hist1[i];
+            len2 += hist2[i];
+            corr += std::sqrt(float(hist1[i]) * float(hist2[i]));
+        }
+
+        const float part1 = 1.F / std::sqrt(len1 * len2);
+
+        return std::sqrt(1.F - part1 * corr);
+    }
+
+    inline float compare(const Histogram &other) const
+    {
+        return compareChannel(red, other.red) + compareChannel(green, other.green)
+            + compareChannel(blue, other.blue);
+    }
+
+    // Counts the histogram and, if brightness is given, the average brightness from 0 to 1 in
+    // a single pass over the image. Safe to call from any thread.
+    static Histogram fromImage(const QImage &img, qreal *brightness = nullptr);
+};
+Q_DECLARE_METATYPE(Histogram);
@@ -0,0 +1,421 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImageFeatureStore.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <iterator>
+
+#if defined(Q_OS_UNIX)
+#include <sys/stat.h>
+#endif
+
+namespace { // anonymous, not visible outside of this file
+const char storeMagic[8] = {'P', 'T', 'F', 'E', 'A', 'T', '0', '2'};
+const quint32 recordMagic = 0x50544652;
+const int maxOpenStores = 16;
+// Only stores at least this large and mostly made of replaced records get compacted
+const qint64 compactThreshold = 1024 * 1024;
+
+enum RecordFlags : quint32
+{
+    HasDifferenceHash = 1,
+    HasHistogram = 2,
+    HasDctHash = 4
+};
+
+quint32 imageHashFlag(ImageHash::Method method)
+{
+    return method == ImageHash::DctHash ? HasDctHash : HasDifferenceHash;
+}
+
+// Each record is this header, followed by the UTF-8 image path and the histogram, if any
+struct RecordHeader
+{
+    quint32 magic;
+    quint32 flags;
+    qint64 lastModified;
+    qint64 fileSize;
+    quint64 inode;
+    // Indexed by ImageHash::Method
+    quint64 imageHashes[2];
+    quint32 pathLength;
+    quint32 reserved;
+};
+
+const qint64 histogramLength = sizeof(Histogram::red) * 3;
+}
+
+std::shared_ptr<ImageFeatureStore> ImageFeatureStore::forDirectory(const QString &directoryPath)
+{
+    static QMutex storesMutex;
+    // Every store still alive, so a file never gets opened and indexed twice
+    static QHash<QString, std::weak_ptr<ImageFeatureStore>> stores;
+    // Keeps the stores used last open, the others only live as long as someone holds them
+    static QList<std::shared_ptr<ImageFeatureStore>> recentlyUsed;
+
+    QMutexLocker locker(&storesMutex);
+    std::shared_ptr<ImageFeatureStore> store = stores.value(directoryPath).lock();
+    if (store) {
+        recentlyUsed.removeOne(store);
+        recentlyUsed.append(store);
+        return store;
+    }
+
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/phototonic/features/");
+    if (!QFileInfo::exists(basePath)) {
+        QDir().mkpath(basePath);
+    }
+
+    const QByteArray hash = QCryptographicHash::hash(QFile::encodeName(directoryPath),
+                                                     QCryptographicHash::Md5)
+                                .toHex();
+    store = std::make_shared<ImageFeatureStore>(basePath + QString::fromLatin1(hash)
+                                                + QStringLiteral(".features"));
+
+    for (auto it = stores.begin(); it != stores.end();) {
+        it = it->expired() ? stores.erase(it) : std::next(it);
+    }
+    stores.insert(directoryPath, store);
+    recentlyUsed.append(store);
+    if (recentlyUsed.size() > maxOpenStores) {
+        recentlyUsed.removeFirst();
+    }
+
+    return store;
+}
+
+ImageFeatureStore::ImageFeatureStore(const QString &storeFilePath)
+    : file(storeFilePath)
+    , lockFile(storeFilePath + QStringLiteral(".lock"))
+{
+    isOpen = open();
+}
+
+quint64 ImageFeatureStore::fileInode(const QString &imagePath)
+{
+#if defined(Q_OS_UNIX)
+    QT_STATBUF status;
+    if (QT_STAT(QFile::encodeName(imagePath).constData(), &status) == 0) {
+        return quint64(status.st_ino);
+    }
+#else
+    Q_UNUSED(imagePath)
+#endif
+    return 0;
+}
+
+bool ImageFeatureStore::open()
+{
+    if (!lockFile.lock()) {
+        qWarning() << "Failed to lock feature store" << file.fileName();
+        return false;
+    }
+    const auto unlock = qScopeGuard([this] { lockFile.unlock(); });
+    return openLocked();
+}
+
+bool ImageFeatureStore::openLocked()
+{
+    // In append mode the records of different processes can only ever follow each other
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qWarning() << "Failed to open feature store" << file.fileName() << file.errorString();
+        return false;
+    }
+    inode = fileInode(file.fileName());
+
+    char magic[sizeof(storeMagic)];
+    if (!file.seek(0) || file.read(magic, sizeof(magic)) != sizeof(magic)
+        || memcmp(magic, storeMagic, sizeof(magic)) != 0) {
+        file.resize(0);
+        file.write(storeMagic, sizeof(storeMagic));
+        file.flush();
+        return true;
+    }
+
+    // Only mapped while indexing, lookups read the few histograms they need
+    const qint64 size = file.size();
+    uchar *data = size > qint64(sizeof(storeMagic)) ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return true;
+    }
+
+    const qint64 end = scan(data, size);
+    const bool compacted = size > compactThreshold && liveBytes * 2 < size && compact(data);
+    file.unmap(data);
+
+    if (compacted) {
+        // The compacted file replaced the one still open
+        file.close();
+        if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+            qWarning() << "Failed to open feature store" << file.fileName() << file.errorString();
+            return false;
+        }
+        inode = fileInode(file.fileName());
+    } else if (end < size) {
+        // Every append holds the lock file, so this is a write that got interrupted and not one
+        // still going on
+        qWarning() << "Dropping damaged tail of feature store" << file.fileName();
+        file.resize(end);
+    }
+    return true;
+}
+
+qint64 ImageFeatureStore::scan(const uchar *data, qint64 size)
+{
+    qint64 pos = sizeof(storeMagic);
+    index.clear();
+    liveBytes = 0;
+
+    while (pos + qint64(sizeof(RecordHeader)) <= size) {
+        RecordHeader header;
+        memcpy(&header, data + pos, sizeof(header));
+        if (header.magic != recordMagic) {
+            break;
+        }
+
+        const qint64 histogramOffset = pos + sizeof(header) + header.pathLength;
+        const qint64 recordLength = histogramOffset - pos
+            + ((header.flags & HasHistogram) ? histogramLength : 0);
+        if (pos + recordLength > size) {
+            break;
+        }
+
+        const QString imagePath = QString::fromUtf8(
+            reinterpret_cast<const char *>(data + pos + sizeof(header)), int(header.pathLength));
+
+        // Later records replace earlier ones of the same image
+        const auto previous = index.constFind(imagePath);
+        if (previous != index.constEnd()) {
+            liveBytes -= previous->length;
+        }
+        index.insert(imagePath,
+                     {pos, recordLength, header.lastModified, header.fileSize, header.inode,
+                      header.flags & (HasDifferenceHash | HasDctHash),
+                      {header.imageHashes[0], header.imageHashes[1]},
+                      (header.flags & HasHistogram) ? histogramOffset : -1});
+        liveBytes += recordLength;
+        pos += recordLength;
+    }
+    return pos;
+}
+
+bool ImageFeatureStore::compact(const uchar *data)
+{
+    QSaveFile compacted(file.fileName());
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QHash<QString, IndexEntry> compactedIndex;
+    qint64 pos = sizeof(storeMagic);
+    compacted.write(storeMagic, sizeof(storeMagic));
+    for (auto entry = index.constBegin(); entry != index.constEnd(); ++entry) {
+        compacted.write(reinterpret_cast<const char *>(data + entry->offset), entry->length);
+
+        IndexEntry moved = entry.value();
+        if (moved.histogramOffset >= 0) {
+            moved.histogramOffset += pos - moved.offset;
+        }
+        moved.offset = pos;
+        compactedIndex.insert(entry.key(), moved);
+        pos += moved.length;
+    }
+
+    if (!compacted.commit()) {
+        qWarning() << "Failed to compact feature store" << file.fileName();
+        return false;
+    }
+
+    index = compactedIndex;
+    return true;
+}
+
+std::shared_ptr<const Histogram> ImageFeatureStore::readHistogram(qint64 offset)
+{
+    auto histogram = std::make_shared<Histogram>();
+    if (!file.seek(offset)
+        || file.read(reinterpret_cast<char *>(histogram->red), sizeof(histogram->red))
+            != sizeof(histogram->red)
+        || file.read(reinterpret_cast<char *>(histogram->green), sizeof(histogram->green))
+            != sizeof(histogram->green)
+        || file.read(reinterpret_cast<char *>(histogram->blue), sizeof(histogram->blue))
+            != sizeof(histogram->blue)) {
+        qWarning() << "Failed to read feature store" << file.fileName() << file.errorString();
+        return nullptr;
+    }
+    return histogram;
+}
+
+const ImageFeatureStore::IndexEntry *ImageFeatureStore::findEntry(const QString &imagePath,
+                                                                  const QDateTime &lastModified,
+                                                                  qint64 fileSize,
+                                                                  quint64 inode) const
+{
+    const auto entry = index.constFind(imagePath);
+    if (entry == index.constEnd() || entry->lastModified != lastModified.toMSecsSinceEpoch()
+        || entry->fileSize != fileSize || entry->inode != inode) {
+        return nullptr;
+    }
+    return &entry.value();
+}
+
+bool ImageFeatureStore::findImageHash(const QString &imagePath, const QDateTime &lastModified,
+                                      qint64 fileSize, ImageHash::Method method,
+                                      quint64 *imageHash)
+{
+    const quint64 inode = fileInode(imagePath);
+
+    QMutexLocker locker(&mutex);
+    const IndexEntry *entry = findEntry(imagePath, lastModified, fileSize, inode);
+    if (entry == nullptr || !(entry->imageHashFlags & imageHashFlag(method))) {
+        return false;
+    }
+
+    *imageHash = entry->imageHashes[method];
+    return true;
+}
+
+std::shared_ptr<const Histogram> ImageFeatureStore::findHistogram(const QString &imagePath,
+                                                                  const QDateTime &lastModified,
+                                                                  qint64 fileSize)
+{
+    const quint64 inode = fileInode(imagePath);
+
+    QMutexLocker locker(&mutex);
+    const IndexEntry *entry = findEntry(imagePath, lastModified, fileSize, inode);
+    if (entry == nullptr || entry->histogramOffset < 0) {
+        return nullptr;
+    }
+    return readHistogram(entry->histogramOffset);
+}
+
+void ImageFeatureStore::insertImageHash(const QString &imagePath, const QDateTime &lastModified,
+                                        qint64 fileSize, ImageHash::Method method,
+                                        quint64 imageHash)
+{
+    Features features;
+    features.imageHashFlags = imageHashFlag(method);
+    features.imageHashes[method] = imageHash;
+    insert(imagePath, lastModified, fileSize, features);
+}
+
+void ImageFeatureStore::insertHistogram(const QString &imagePath, const QDateTime &lastModified,
+                                        qint64 fileSize,
+                                        const std::shared_ptr<const Histogram> &histogram)
+{
+    Features features;
+    features.histogram = histogram;
+    insert(imagePath, lastModified, fileSize, features);
+}
+
+void ImageFeatureStore::insert(const QString &imagePath, const QDateTime &lastModified,
+                               qint64 fileSize, const Features &features)
+{
+    const quint64 inode = fileInode(imagePath);
+    const QByteArray path = imagePath.toUtf8();
+
+    QMutexLocker locker(&mutex);
+    if (!isOpen) {
+        return;
+    }
+
+    if (!lockFile.lock()) {
+        qWarning() << "Failed to lock feature store" << file.fileName();
+        return;
+    }
+    const auto unlock = qScopeGuard([this] { lockFile.unlock(); });
+    if (fileInode(file.fileName()) != inode) {
+        // Another process compacted the store, appends to the old file would be lost
+        file.close();
+        isOpen = openLocked();
+        if (!isOpen) {
+            return;
+        }
+    }
+
+    // Features stored earlier for the same version of the image are carried over
+    Features merged = features;
+    const IndexEntry *current = findEntry(imagePath, lastModified, fileSize, inode);
+    if (current != nullptr) {
+        for (const ImageHash::Method method : {ImageHash::DifferenceHash, ImageHash::DctHash}) {
+            const quint32 flag = imageHashFlag(method);
+            if (!(merged.imageHashFlags & flag) && (current->imageHashFlags & flag)) {
+                merged.imageHashFlags |= flag;
+                merged.imageHashes[method] = current->imageHashes[method];
+            }
+        }
+        if (!merged.histogram && current->histogramOffset >= 0) {
+            merged.histogram = readHistogram(current->histogramOffset);
+        }
+    }
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = recordMagic;
+    header.flags = merged.imageHashFlags | (merged.histogram ? HasHistogram : 0);
+    header.lastModified = lastModified.toMSecsSinceEpoch();
+    header.fileSize = fileSize;
+    header.inode = inode;
+    header.imageHashes[0] = merged.imageHashes[0];
+    header.imageHashes[1] = merged.imageHashes[1];
+    header.pathLength = path.size();
+
+    // Nobody else appends while the lock file is held, so this is where the record goes
+    const qint64 offset = file.size();
+    bool written =
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header)
+        && file.write(path) == path.size();
+    if (written && merged.histogram) {
+        const Histogram &histogram = *merged.histogram;
+        written = file.write(reinterpret_cast<const char *>(histogram.red), sizeof(histogram.red))
+                == sizeof(histogram.red)
+            && file.write(reinterpret_cast<const char *>(histogram.green),
+                          sizeof(histogram.green))
+                == sizeof(histogram.green)
+            && file.write(reinterpret_cast<const char *>(histogram.blue), sizeof(histogram.blue))
+                == sizeof(histogram.blue);
+    }
+    // All of it has to be in the file before the lock file is released
+    written = written && file.flush();
+    if (!written) {
+        qWarning() << "Failed to write feature store" << file.fileName() << file.errorString();
+        file.resize(offset);
+        return;
+    }
+
+    const qint64 histogramOffset = offset + sizeof(header) + path.size();
+    const qint64 recordLength =
+        histogramOffset - offset + (merged.histogram ? histogramLength : 0);
+    const auto previous = index.constFind(imagePath);
+    if (previous != index.constEnd()) {
+        liveBytes -= previous->length;
+    }
+    index.insert(imagePath,
+                 {offset, recordLength, header.lastModified, header.fileSize, inode,
+                  merged.imageHashFlags, {merged.imageHashes[0], merged.imageHashes[1]},
+                  merged.histogram ? histogramOffset : -1});
+    liveBytes += recordLength;
+}
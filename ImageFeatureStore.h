@@ -0,0 +1,111 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Histogram.h"
+#include "ImageHash.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+
+#include <memory>
+
+// Keeps what duplicate search and similarity sorting compute per image, so later runs only
+// have to read new and changed images. Like ThumbnailPack there is one append-only file per
+// directory, indexed in memory on open. An entry is only valid as long as the path, inode, size
+// and modification time of the image are unchanged. Histograms stay on disk until asked for.
+// There is only ever one instance per store file, shared between threads, and all methods are
+// thread safe. Other processes are kept out by a lock file, the same way as for ThumbnailPack.
+class ImageFeatureStore {
+public:
+    static std::shared_ptr<ImageFeatureStore> forDirectory(const QString &directoryPath);
+
+    explicit ImageFeatureStore(const QString &storeFilePath);
+
+    // Returns false if no hash of the method is stored for the image as it is now
+    bool findImageHash(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+                       ImageHash::Method method, quint64 *imageHash);
+
+    // Returns null if no histogram is stored for the image as it is now
+    std::shared_ptr<const Histogram> findHistogram(const QString &imagePath,
+                                                   const QDateTime &lastModified, qint64 fileSize);
+
+    void insertImageHash(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+                         ImageHash::Method method, quint64 imageHash);
+
+    void insertHistogram(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+                         const std::shared_ptr<const Histogram> &histogram);
+
+private:
+    struct Features
+    {
+        // One RecordFlags bit per known hash, the hashes are indexed by ImageHash::Method
+        quint32 imageHashFlags = 0;
+        quint64 imageHashes[2] = {};
+        // Null if unknown
+        std::shared_ptr<const Histogram> histogram;
+    };
+
+    struct IndexEntry
+    {
+        qint64 offset;
+        qint64 length;
+        qint64 lastModified;
+        qint64 fileSize;
+        quint64 inode;
+        quint32 imageHashFlags;
+        quint64 imageHashes[2];
+        // Offset of the histogram in the file, -1 if there is none
+        qint64 histogramOffset;
+    };
+
+    // Takes the lock file and opens the store
+    bool open();
+
+    // Opens, scans and if need be compacts the store, with the lock file held
+    bool openLocked();
+
+    // Indexes the records and returns where the last complete one ends
+    qint64 scan(const uchar *data, qint64 size);
+
+    bool compact(const uchar *data);
+
+    std::shared_ptr<const Histogram> readHistogram(qint64 offset);
+
+    // Returns the entry of the image if it is still valid, the caller holds the lock
+    const IndexEntry *findEntry(const QString &imagePath, const QDateTime &lastModified,
+                                qint64 fileSize, quint64 inode) const;
+
+    // Adds the known features to the ones already stored for the image
+    void insert(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+                const Features &features);
+
+    static quint64 fileInode(const QString &imagePath);
+
+    QMutex mutex;
+    QFile file;
+    QLockFile lockFile;
+    // Of the file when it was opened, a different one means another process compacted the store
+    quint64 inode = 0;
+    QHash<QString, IndexEntry> index;
+    qint64 liveBytes = 0;
+    bool isOpen = false;
+};
@@ -0,0 +1,150 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImageHash.h"
+
+#include <QDebug>
+#include <QImageReader>
+#include <QtMath>
+
+#include <algorithm>
+#include <array>
+
+namespace { // anonymous, not visible outside of this file
+const int dctSize = 32;
+const int hashSize = 8;
+
+// cosines[k][n] of the DCT-II, only the lowest frequencies are needed
+struct DctTable
+{
+    DctTable()
+    {
+        for (int k = 0; k < hashSize; ++k) {
+            for (int n = 0; n < dctSize; ++n) {
+                cosines[k][n] = float(qCos(M_PI * (n + 0.5) * k / dctSize));
+                transposed[n][k] = cosines[k][n];
+            }
+        }
+    }
+
+    float cosines[hashSize][dctSize];
+    float transposed[dctSize][hashSize];
+};
+}
+
+namespace ImageHash {
+
+bool read(const QString &filePath, Method method, quint64 *hash)
+{
+    QImageReader reader(filePath);
+    reader.setQuality(50);
+    QSize size = reader.size();
+    if (method == DctHash) {
+        size = QSize(dctSize, dctSize);
+    } else if (size.isValid()) {
+        size.scale(QSize(9, 9), Qt::KeepAspectRatioByExpanding);
+    }
+    if (size.isValid()) {
+        reader.setScaledSize(size);
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qWarning() << "invalid image" << filePath << reader.errorString();
+        return false;
+    }
+
+    image = image.convertToFormat(QImage::Format_Grayscale8);
+    if (method == DctHash) {
+        *hash = dctHash(image.size() == QSize(dctSize, dctSize)
+                            ? image
+                            : image.scaled(dctSize, dctSize, Qt::IgnoreAspectRatio,
+                                           Qt::SmoothTransformation));
+    } else {
+        *hash = differenceHash(image.scaled(9, 9, Qt::KeepAspectRatioByExpanding));
+    }
+    return true;
+}
+
+quint64 differenceHash(const QImage &image)
+{
+    quint64 hash = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar *line = image.constScanLine(y);
+        for (int x = 0; x < 8; x++) {
+            if (line[x] > line[x + 1]) {
+                hash |= quint64(1) << (y * 8 + x);
+            }
+        }
+    }
+    return hash;
+}
+
+quint64 dctHash(const QImage &image)
+{
+    static const DctTable table;
+
+    // Both passes of the separable transform are written as sums of scaled rows over
+    // contiguous arrays, with no reduction in the inner loop, so compilers vectorize them
+    // without fast-math for whatever SIMD width the target has
+    alignas(32) float pixels[dctSize][dctSize];
+    for (int y = 0; y < dctSize; ++y) {
+        const uchar *line = image.constScanLine(y);
+        for (int x = 0; x < dctSize; ++x) {
+            pixels[y][x] = line[x];
+        }
+    }
+
+    // Vertical frequencies per column
+    alignas(32) float columns[hashSize][dctSize] = {};
+    for (int k = 0; k < hashSize; ++k) {
+        for (int y = 0; y < dctSize; ++y) {
+            const float c = table.cosines[k][y];
+            for (int x = 0; x < dctSize; ++x) {
+                columns[k][x] += c * pixels[y][x];
+            }
+        }
+    }
+
+    // Then horizontal frequencies
+    alignas(32) float coefficients[hashSize][hashSize] = {};
+    for (int k = 0; k < hashSize; ++k) {
+        for (int x = 0; x < dctSize; ++x) {
+            const float c = columns[k][x];
+            for (int l = 0; l < hashSize; ++l) {
+                coefficients[k][l] += c * table.transposed[x][l];
+            }
+        }
+    }
+
+    // The DC coefficient is the mean brightness, it takes no part and its bit stays unset
+    std::array<float, hashSize * hashSize - 1> acCoefficients;
+    std::copy(&coefficients[0][1], &coefficients[0][0] + hashSize * hashSize,
+              acCoefficients.begin());
+    const auto middle = acCoefficients.begin() + acCoefficients.size() / 2;
+    std::nth_element(acCoefficients.begin(), middle, acCoefficients.end());
+    const float median = *middle;
+
+    quint64 hash = 0;
+    for (int i = 1; i < hashSize * hashSize; ++i) {
+        if (coefficients[i / hashSize][i % hashSize] > median) {
+            hash |= quint64(1) << i;
+        }
+    }
+    return hash;
+}
+}
@@ -0,0 +1,45 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+// 64 bit perceptual hashes for finding duplicate images. Similar images get hashes which differ
+// in few bits, see ImageHashIndex for finding them.
+namespace ImageHash {
+
+enum Method
+{
+    // Brightness gradients between neighbouring pixels of a 9x8 image. Cheap, but thrown off by
+    // gamma changes and crops.
+    DifferenceHash = 0,
+    // Signs of the lowest frequencies of the discrete cosine transform of a 32x32 image against
+    // their median. Robust against gamma, contrast and small edits.
+    DctHash = 1
+};
+
+// Decodes the image at the reduced size the method needs, which JPEG and some other formats do
+// at a fraction of the cost of a full decode. Returns false if the image cannot be read.
+bool read(const QString &filePath, Method method, quint64 *hash);
+
+// Expect grayscale images of 9x9 and 32x32 pixels respectively
+quint64 differenceHash(const QImage &image);
+
+quint64 dctHash(const QImage &image);
+}
@@ -0,0 +1,106 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImageHashIndex.h"
+
+#include <bitset>
+
+void ImageHashIndex::insert(quint64 hash, int id)
+{
+    if (heads.isEmpty()) {
+        heads.fill(-1, blockCount << blockBits);
+    }
+
+    Entry entry;
+    entry.hash = hash;
+    entry.id = id;
+    for (int i = 0; i < blockCount; ++i) {
+        int &head = heads[(i << blockBits) | block(hash, i)];
+        entry.next[i] = head;
+        head = entries.size();
+    }
+    entries.append(entry);
+}
+
+int ImageHashIndex::findNearest(quint64 hash, int maxDistance) const
+{
+    if (entries.isEmpty()) {
+        return -1;
+    }
+
+    maxDistance = qBound(0, maxDistance, int(maxSearchDistance));
+    const int blockDistance = maxDistance / blockCount;
+    int bestId = -1;
+    int bestDistance = maxDistance + 1;
+    for (int i = 0; i < blockCount; ++i) {
+        const quint16 queryBlock = block(hash, i);
+        for (const quint16 mask : blockMasks()) {
+            if (std::bitset<16>(mask).count() > size_t(blockDistance)) {
+                break;
+            }
+
+            const int head = heads.at((i << blockBits) | quint16(queryBlock ^ mask));
+            for (int entry = head; entry >= 0; entry = entries.at(entry).next[i]) {
+                const Entry &candidate = entries.at(entry);
+                const int candidateDistance = distance(hash, candidate.hash);
+                if (candidateDistance < bestDistance
+                    || (candidateDistance == bestDistance && candidate.id < bestId)) {
+                    bestId = candidate.id;
+                    bestDistance = candidateDistance;
+                }
+            }
+        }
+    }
+    return bestId;
+}
+
+void ImageHashIndex::clear()
+{
+    entries.clear();
+    heads.clear();
+}
+
+int ImageHashIndex::size() const
+{
+    return entries.size();
+}
+
+int ImageHashIndex::distance(quint64 a, quint64 b)
+{
+    return int(std::bitset<64>(a ^ b).count());
+}
+
+quint16 ImageHashIndex::block(quint64 hash, int index)
+{
+    return quint16(hash >> (index * blockBits));
+}
+
+const QVector<quint16> &ImageHashIndex::blockMasks()
+{
+    static const QVector<quint16> masks = [] {
+        QVector<quint16> result;
+        for (size_t bits = 0; bits <= maxSearchDistance / blockCount; ++bits) {
+            for (int mask = 0; mask <= 0xffff; ++mask) {
+                if (std::bitset<16>(mask).count() == bits) {
+                    result.append(quint16(mask));
+                }
+            }
+        }
+        return result;
+    }();
+    return masks;
+}
@@ -0,0 +1,64 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QtGlobal>
+#include <QVector>
+
+// Finds image hashes within a Hamming distance of a query hash by multi-index hashing. The 64
+// bit hashes are split into four 16 bit blocks with one table each. Two hashes at most
+// maxDistance bits apart have at least one block at most maxDistance / 4 bits apart, so a query
+// only looks at the table entries near its own blocks instead of at all hashes.
+class ImageHashIndex {
+public:
+    // Largest distance findNearest() supports
+    static const int maxSearchDistance = 15;
+
+    void insert(quint64 hash, int id);
+
+    // Returns the id of the closest hash at most maxDistance bits away, or -1 if there is none.
+    // Ties go to the lower id.
+    [[nodiscard]] int findNearest(quint64 hash, int maxDistance) const;
+
+    void clear();
+
+    [[nodiscard]] int size() const;
+
+    static int distance(quint64 a, quint64 b);
+
+private:
+    static const int blockCount = 4;
+    static const int blockBits = 16;
+
+    static quint16 block(quint64 hash, int index);
+
+    // All 16 bit masks with at most maxSearchDistance / blockCount bits set, fewest bits first
+    static const QVector<quint16> &blockMasks();
+
+    struct Entry
+    {
+        quint64 hash;
+        int id;
+        // Next entry with the same block value, per block
+        int next[blockCount];
+    };
+
+    QVector<Entry> entries;
+    // First entry per block value, per block, allocated with the first entry
+    QVector<int> heads;
+};
@@ -0,0 +1,220 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImagePrefetcher.h"
+#include "PipelineStats.h"
+#include "Settings.h"
+#include "Trace.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRunnable>
+
+#include <algorithm>
+#include <utility>
+
+class ImagePrefetcher::Worker : public QRunnable {
+public:
+    explicit Worker(ImagePrefetcher *prefetcher)
+        : prefetcher(prefetcher)
+    {
+    }
+
+    void run() override
+    {
+        prefetcher->processRequests();
+    }
+
+private:
+    ImagePrefetcher *prefetcher;
+};
+
+ImagePrefetcher::ImagePrefetcher()
+{
+    // The next and the previous image side by side, more would only slow down the current one
+    threadPool.setMaxThreadCount(2);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    {
+        QMutexLocker locker(&mutex);
+        pendingFiles.clear();
+    }
+    threadPool.waitForDone();
+}
+
+void ImagePrefetcher::prefetch(const QStringList &filePaths)
+{
+    QMutexLocker locker(&mutex);
+    budgetBytes = qint64(Settings::imageCacheSize) * 1024 * 1024;
+    wantedFiles = filePaths;
+    pendingFiles.clear();
+    if (budgetBytes == 0) {
+        entries.clear();
+        totalBytes = 0;
+        return;
+    }
+
+    for (const QString &filePath : filePaths) {
+        const bool isCached =
+            std::any_of(entries.cbegin(), entries.cend(),
+                        [&](const Entry &entry) { return entry.filePath == filePath; });
+        if (!isCached && !decodingFiles.contains(filePath)) {
+            pendingFiles.append(filePath);
+        }
+    }
+
+    while (activeWorkers < qMin(threadPool.maxThreadCount(), pendingFiles.size())) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+bool ImagePrefetcher::find(const QString &filePath, QImage *image)
+{
+    const QFileInfo fileInfo(filePath);
+
+    QMutexLocker locker(&mutex);
+    if (decodingFiles.contains(filePath)) {
+        Trace::Scope trace("ImagePrefetcher::wait", filePath);
+        while (decodingFiles.contains(filePath)) {
+            imageDecoded.wait(&mutex);
+        }
+    }
+
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->filePath != filePath) {
+            continue;
+        }
+        if (it->lastModified == fileInfo.lastModified() && it->fileSize == fileInfo.size()) {
+            entries.splice(entries.begin(), entries, it);
+            *image = it->image;
+            PipelineStats::increment(PipelineStats::ImageCacheHit);
+            return true;
+        }
+        totalBytes -= it->bytes;
+        entries.erase(it);
+        break;
+    }
+
+    // The caller decodes it right away, a worker doing the same would be wasted
+    pendingFiles.removeOne(filePath);
+    PipelineStats::increment(PipelineStats::ImageCacheMiss);
+    return false;
+}
+
+void ImagePrefetcher::insert(const QString &filePath, const QImage &image)
+{
+    const QFileInfo fileInfo(filePath);
+
+    Entry entry;
+    entry.filePath = filePath;
+    entry.image = image;
+    entry.lastModified = fileInfo.lastModified();
+    entry.fileSize = fileInfo.size();
+    entry.bytes = image.sizeInBytes();
+
+    QMutexLocker locker(&mutex);
+    budgetBytes = qint64(Settings::imageCacheSize) * 1024 * 1024;
+    store(std::move(entry));
+}
+
+void ImagePrefetcher::processRequests()
+{
+    for (;;) {
+        Entry entry;
+        qint64 maxBytes;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingFiles.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            entry.filePath = pendingFiles.takeFirst();
+            decodingFiles.insert(entry.filePath);
+            maxBytes = budgetBytes;
+        }
+
+        const QFileInfo fileInfo(entry.filePath);
+        entry.lastModified = fileInfo.lastModified();
+        entry.fileSize = fileInfo.size();
+        {
+            Trace::Scope trace("ImagePrefetcher::decode", entry.filePath);
+            QImageReader imageReader(entry.filePath);
+            const QSize size = imageReader.size();
+            // Assuming 32 bits per pixel, images which could never fit are not even decoded
+            if (!imageReader.supportsAnimation() && size.isValid()
+                && qint64(size.width()) * size.height() * 4 <= maxBytes) {
+                imageReader.read(&entry.image);
+            }
+        }
+        entry.bytes = entry.image.sizeInBytes();
+
+        QMutexLocker locker(&mutex);
+        decodingFiles.remove(entry.filePath);
+        if (!entry.image.isNull()) {
+            store(std::move(entry));
+        }
+        imageDecoded.wakeAll();
+    }
+}
+
+void ImagePrefetcher::store(Entry entry)
+{
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->filePath == entry.filePath) {
+            totalBytes -= it->bytes;
+            entries.erase(it);
+            break;
+        }
+    }
+
+    if (entry.bytes > budgetBytes) {
+        return;
+    }
+
+    const int entryRank = rank(entry.filePath);
+    const int unwantedRank = wantedFiles.size();
+    while (totalBytes + entry.bytes > budgetBytes) {
+        // The least recently used of the least important images
+        auto victim = entries.end();
+        int victimRank = -1;
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            const int itRank = rank(it->filePath);
+            if (itRank >= victimRank) {
+                victim = it;
+                victimRank = itRank;
+            }
+        }
+        // Wanted images only make room for more important ones, so neighbours do not thrash
+        if (victimRank < unwantedRank && victimRank <= entryRank) {
+            return;
+        }
+        totalBytes -= victim->bytes;
+        entries.erase(victim);
+    }
+
+    totalBytes += entry.bytes;
+    entries.push_front(std::move(entry));
+}
+
+int ImagePrefetcher::rank(const QString &filePath) const
+{
+    const int index = wantedFiles.indexOf(filePath);
+    return index < 0 ? wantedFiles.size() : index;
+}
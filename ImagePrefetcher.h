@@ -0,0 +1,83 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QDateTime>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <list>
+
+// Decodes the images the viewer is likely to show next on a pool of worker threads and keeps
+// them, as read from the file without the EXIF rotation, within the Settings::imageCacheSize
+// budget. Once the budget is exceeded the images which are not wanted any more go first, in
+// least recently used order, then the wanted ones furthest down the list. Animations are left
+// to the viewer.
+class ImagePrefetcher {
+public:
+    ImagePrefetcher();
+
+    ~ImagePrefetcher();
+
+    // Replaces the wanted images, most important first, and decodes the ones not cached yet
+    void prefetch(const QStringList &filePaths);
+
+    // Waits for the image if a worker is decoding it. Returns false if it is not cached or the
+    // file changed since, in which case the caller decodes it and hands it to insert().
+    bool find(const QString &filePath, QImage *image);
+
+    void insert(const QString &filePath, const QImage &image);
+
+private:
+    class Worker;
+
+    struct Entry
+    {
+        QString filePath;
+        QImage image;
+        QDateTime lastModified;
+        qint64 fileSize = 0;
+        qint64 bytes = 0;
+    };
+
+    void processRequests();
+
+    // Makes room for the entry and adds it, or drops it if it would only push out images which
+    // are more important. Called with the mutex held.
+    void store(Entry entry);
+
+    // Position in the wanted list, which is the eviction order, unwanted images last
+    [[nodiscard]] int rank(const QString &filePath) const;
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QWaitCondition imageDecoded;
+    // Most recently used first
+    std::list<Entry> entries;
+    qint64 totalBytes = 0;
+    // Taken from the Settings on the GUI thread
+    qint64 budgetBytes = 0;
+    QStringList wantedFiles;
+    QStringList pendingFiles;
+    QSet<QString> decodingFiles;
+    int activeWorkers = 0;
+};
@@ -23,6 +23,7 @@
 #include "Phototonic.h"
 #include "Settings.h"
 #include "ThumbsViewer.h"
+#include "Trace.h"
 
 #include <QApplication>
 #include <QClipboard>
@@ -36,6 +37,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <utility>
 
 constexpr const char *CLIPBOARD_IMAGE_NAME = "clipboard.png";
 #define ROUND(x) ((int)((x) + 0.5))
@@ -327,9 +329,13 @@ void ImageViewer::centerImage(const QSize &imgSize)
 }
 
 void ImageViewer::rotateByExifRotation(QImage &image, const QString &imageFullPath)
+{
+    rotateByExifOrientation(image, metadataCache->getImageOrientation(imageFullPath));
+}
+
+void ImageViewer::rotateByExifOrientation(QImage &image, long orientation)
 {
     QTransform trans;
-    long orientation = metadataCache->getImageOrientation(imageFullPath);
 
     switch (orientation) {
     case 1:
@@ -367,16 +373,16 @@ void ImageViewer::rotateByExifRotation(QImage &image, const QString &imageFullPa
     }
 }
 
-void ImageViewer::transform()
+QImage ImageViewer::transformImage(QImage image)
 {
     if (!qFuzzyCompare(Settings::rotation, 0)) {
         QTransform trans;
         trans.rotate(Settings::rotation);
-        viewerImage = viewerImage.transformed(trans, Qt::SmoothTransformation);
+        image = image.transformed(trans, Qt::SmoothTransformation);
     }
 
     if (Settings::flipH || Settings::flipV) {
-        viewerImage = viewerImage.mirrored(Settings::flipH, Settings::flipV);
+        image = image.mirrored(Settings::flipH, Settings::flipV);
     }
 
     int cropLeftPercentPixels = 0, cropTopPercentPixels = 0, cropWidthPercentPixels = 0,
@@ -385,27 +391,33 @@ void ImageViewer::transform()
     if (Settings::cropLeftPercent || Settings::cropTopPercent || Settings::cropWidthPercent
         || Settings::cropHeightPercent) {
         croppingOn = true;
-        cropLeftPercentPixels = (viewerImage.width() * Settings::cropLeftPercent) / 100;
-        cropTopPercentPixels = (viewerImage.height() * Settings::cropTopPercent) / 100;
-        cropWidthPercentPixels = (viewerImage.width() * Settings::cropWidthPercent) / 100;
-        cropHeightPercentPixels = (viewerImage.height() * Settings::cropHeightPercent) / 100;
+        cropLeftPercentPixels = (image.width() * Settings::cropLeftPercent) / 100;
+        cropTopPercentPixels = (image.height() * Settings::cropTopPercent) / 100;
+        cropWidthPercentPixels = (image.width() * Settings::cropWidthPercent) / 100;
+        cropHeightPercentPixels = (image.height() * Settings::cropHeightPercent) / 100;
     }
 
     if (Settings::cropLeft || Settings::cropTop || Settings::cropWidth || Settings::cropHeight) {
-        viewerImage = viewerImage.copy(
+        image = image.copy(
             Settings::cropLeft + cropLeftPercentPixels, Settings::cropTop + cropTopPercentPixels,
-            viewerImage.width() - Settings::cropLeft - Settings::cropWidth - cropLeftPercentPixels
+            image.width() - Settings::cropLeft - Settings::cropWidth - cropLeftPercentPixels
                 - cropWidthPercentPixels,
-            viewerImage.height() - Settings::cropTop - Settings::cropHeight - cropTopPercentPixels
+            image.height() - Settings::cropTop - Settings::cropHeight - cropTopPercentPixels
                 - cropHeightPercentPixels);
     } else {
         if (croppingOn) {
-            viewerImage = viewerImage.copy(
+            image = image.copy(
                 cropLeftPercentPixels, cropTopPercentPixels,
-                viewerImage.width() - cropLeftPercentPixels - cropWidthPercentPixels,
-                viewerImage.height() - cropTopPercentPixels - cropHeightPercentPixels);
+                image.width() - cropLeftPercentPixels - cropWidthPercentPixels,
+                image.height() - cropTopPercentPixels - cropHeightPercentPixels);
         }
     }
+    return image;
+}
+
+void ImageViewer::transform()
+{
+    viewerImage = transformImage(std::move(viewerImage));
 }
 
 void ImageViewer::mirror()
@@ -554,24 +566,24 @@ void hslToRgb(double h, double s, double l, unsigned char *red, unsigned char *g
     }
 }
 
-void ImageViewer::colorize()
+QImage ImageViewer::colorizeImage(QImage image)
 {
     int y, x;
     unsigned char hr, hg, hb;
     int r, g, b;
     QRgb *line;
     unsigned char h, s, l;
-    static unsigned char contrastTransform[256];
-    static unsigned char brightTransform[256];
-    bool hasAlpha = viewerImage.hasAlphaChannel();
+    unsigned char contrastTransform[256];
+    unsigned char brightTransform[256];
+    bool hasAlpha = image.hasAlphaChannel();
 
-    switch (viewerImage.format()) {
+    switch (image.format()) {
     case QImage::Format_RGB32:
     case QImage::Format_ARGB32:
     case QImage::Format_ARGB32_Premultiplied:
         break;
     default:
-        viewerImage = viewerImage.convertToFormat(QImage::Format_RGB32);
+        image = image.convertToFormat(QImage::Format_RGB32);
     }
 
     int i;
@@ -593,10 +605,10 @@ void ImageViewer::colorize()
         brightTransform[i] = std::min(255, (int)((255.0 * pow(i / 255.0, 1.0 / brightness)) + 0.5));
     }
 
-    for (y = 0; y < viewerImage.height(); ++y) {
+    for (y = 0; y < image.height(); ++y) {
 
-        line = (QRgb *)viewerImage.scanLine(y);
-        for (x = 0; x < viewerImage.width(); ++x) {
+        line = (QRgb *)image.scanLine(y);
+        for (x = 0; x < image.width(); ++x) {
             r = Settings::rNegateEnabled ? bound0To255(255 - qRed(line[x])) : qRed(line[x]);
             g = Settings::gNegateEnabled ? bound0To255(255 - qGreen(line[x])) : qGreen(line[x]);
             b = Settings::bNegateEnabled ? bound0To255(255 - qBlue(line[x])) : qBlue(line[x]);
@@ -630,6 +642,12 @@ void ImageViewer::colorize()
             }
         }
     }
+    return image;
+}
+
+void ImageViewer::colorize()
+{
+    viewerImage = colorizeImage(std::move(viewerImage));
 }
 
 void ImageViewer::refresh()
@@ -695,6 +713,7 @@ QImage createImageWithOverlay(const QImage &baseImage, const QImage &overlayImag
 
 void ImageViewer::reload()
 {
+    Trace::Scope trace("ImageViewer::reload", viewerImageFullPath);
     if (Settings::showImageName) {
         if (viewerImageFullPath.isEmpty()) {
             setInfo(QStringLiteral("Clipboard"));
@@ -730,12 +749,15 @@ void ImageViewer::reload()
         }
     }
 
+    // Prefetched images are never animations, only the EXIF rotation is left to do for them
+    const bool isPrefetched = !batchMode && imagePrefetcher.find(viewerImageFullPath, &origImage);
+
     QImageReader imageReader(viewerImageFullPath);
     if (batchMode && imageReader.supportsAnimation()) {
         qWarning() << tr("skipping animation in batch mode:") << viewerImageFullPath;
         return;
     }
-    if (Settings::enableAnimations && imageReader.supportsAnimation()) {
+    if (!isPrefetched && Settings::enableAnimations && imageReader.supportsAnimation()) {
         if (animation != nullptr) {
             delete animation;
             animation = nullptr;
@@ -759,7 +781,15 @@ void ImageViewer::reload()
 
     // It's not a movie
 
-    if (imageReader.size().isValid() && imageReader.read(&origImage)) {
+    bool isLoaded = isPrefetched;
+    if (!isLoaded && imageReader.size().isValid() && imageReader.read(&origImage)) {
+        isLoaded = true;
+        if (!batchMode && !imageReader.supportsAnimation()) {
+            imagePrefetcher.insert(viewerImageFullPath, origImage);
+        }
+    }
+
+    if (isLoaded) {
         if (Settings::exifRotationEnabled) {
             rotateByExifRotation(origImage, viewerImageFullPath);
         }
@@ -794,6 +824,11 @@ void ImageViewer::reload()
     }
 }
 
+void ImageViewer::prefetchImages(const QStringList &imageFileNames)
+{
+    imagePrefetcher.prefetch(imageFileNames);
+}
+
 void ImageViewer::setInfo(const QString &infoString)
 {
     imageInfoLabel->setText(infoString);
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "ImagePrefetcher.h"
 #include "MetadataCache.h"
 
 #include <QGraphicsDropShadowEffect>
@@ -85,6 +86,9 @@ public:
 
     void reload();
 
+    // Decodes the images in the background, most likely to be shown next first
+    void prefetchImages(const QStringList &imageFileNames);
+
     [[nodiscard]] int getImageWidthPreCropped() const { return origImage.width(); }
 
     [[nodiscard]] int getImageHeightPreCropped() const { return origImage.height(); }
@@ -95,6 +99,8 @@ public:
 
     void rotateByExifRotation(QImage &image, const QString &imageFullPath);
 
+    static void rotateByExifOrientation(QImage &image, long orientation);
+
     void setInfo(const QString &infoString);
 
     void setFeedback(const QString &feedbackString, bool timeLimited = true);
@@ -103,6 +109,12 @@ public:
 
     [[nodiscard]] QPoint getContextMenuPosition() const { return contextMenuPosition; }
 
+    // Applies the rotation, flips and cropping from the Settings
+    [[nodiscard]] static QImage transformImage(QImage image);
+
+    // Applies the color adjustments from the Settings
+    [[nodiscard]] static QImage colorizeImage(QImage image);
+
 signals:
     void toolsUpdated();
 
@@ -162,6 +174,7 @@ private:
     QPoint cropOrigin;
     QPoint contextMenuPosition;
     std::shared_ptr<MetadataCache> metadataCache;
+    ImagePrefetcher imagePrefetcher;
 
     void setMouseMoveData(bool lockMove, int lMouseX, int lMouseY);
 
@@ -17,72 +17,249 @@
  */
 
 #include "MetadataCache.h"
+#include "PipelineStats.h"
 #include "Settings.h"
 
 #include <QDebug>
-#include <QLabel>
-#include <QScrollArea>
-#include <QSpinBox>
+#include <QRunnable>
 
 #include <exiv2/exiv2.hpp>
 
-void MetadataCache::updateImageTags(const QString &imageFileName, QSet<QString> tags)
+class MetadataCache::Loader : public QRunnable {
+public:
+    explicit Loader(MetadataCache *metadataCache)
+        : metadataCache(metadataCache)
+    {
+    }
+
+    void run() override
+    {
+        metadataCache->processPendingLoads();
+    }
+
+private:
+    MetadataCache *metadataCache;
+};
+
+MetadataCache::MetadataCache(QObject *parent)
+    : QObject(parent)
+{
+    // Not thread safe, so it has to happen before the loader thread starts
+    Exiv2::XmpParser::initialize();
+
+    // One thread keeps the reads sequential, which is what spinning disks like
+    loaderPool.setMaxThreadCount(1);
+}
+
+MetadataCache::~MetadataCache()
+{
+    {
+        QMutexLocker locker(&mutex);
+        pendingLoads.clear();
+        pendingLoadsSet.clear();
+    }
+    loaderPool.waitForDone();
+}
+
+void MetadataCache::updateImageTags(const QString &imageFileName, const QSet<QString> &tags)
 {
+    ensureLoaded(imageFileName);
+    QMutexLocker locker(&mutex);
     cache[imageFileName].tags = tags;
 }
 
 bool MetadataCache::removeTagFromImage(const QString &imageFileName, const QString &tagName)
 {
+    ensureLoaded(imageFileName);
+    QMutexLocker locker(&mutex);
     return cache[imageFileName].tags.remove(tagName);
 }
 
 void MetadataCache::removeImage(const QString &imageFileName)
 {
+    QMutexLocker locker(&mutex);
     cache.remove(imageFileName);
 }
 
-QSet<QString> &MetadataCache::getImageTags(const QString &imageFileName)
+QSet<QString> MetadataCache::getImageTags(const QString &imageFileName)
 {
-    return cache[imageFileName].tags;
+    ensureLoaded(imageFileName);
+    QMutexLocker locker(&mutex);
+    return cache.value(imageFileName).tags;
 }
 
 long MetadataCache::getImageOrientation(const QString &imageFileName)
 {
-    if (cache.contains(imageFileName) || loadImageMetadata(imageFileName)) {
-        return cache[imageFileName].orientation;
+    ensureLoaded(imageFileName);
+    QMutexLocker locker(&mutex);
+    return cache.value(imageFileName).orientation;
+}
+
+bool MetadataCache::getCachedImageOrientation(const QString &imageFileName, long *orientation)
+{
+    QMutexLocker locker(&mutex);
+    const auto it = cache.constFind(imageFileName);
+    if (it == cache.constEnd()) {
+        return false;
     }
 
-    return 0;
+    *orientation = it->orientation;
+    return true;
 }
 
-void MetadataCache::setImageTags(const QString &imageFileName, const QSet<QString> &tags)
+bool MetadataCache::isCached(const QString &imageFileName)
 {
-    ImageMetadata imageMetadata;
+    QMutexLocker locker(&mutex);
+    return cache.contains(imageFileName);
+}
 
-    imageMetadata.tags = tags;
-    cache.insert(imageFileName, imageMetadata);
+void MetadataCache::setImageTags(const QString &imageFileName, const QSet<QString> &tags)
+{
+    updateImageTags(imageFileName, tags);
 }
 
 void MetadataCache::addTagToImage(const QString &imageFileName, const QString &tagName)
 {
+    ensureLoaded(imageFileName);
+    QMutexLocker locker(&mutex);
     cache[imageFileName].tags.insert(tagName);
 }
 
 void MetadataCache::clear()
 {
+    QMutexLocker locker(&mutex);
     cache.clear();
+    pendingLoads.clear();
+    pendingLoadsSet.clear();
+    loadedImages.clear();
+    ++generation;
+}
+
+void MetadataCache::ensureLoaded(const QString &imageFileName)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (cache.contains(imageFileName)) {
+            return;
+        }
+    }
+
+    loadImageMetadata(imageFileName);
 }
 
 bool MetadataCache::loadImageMetadata(const QString &imageFullPath)
 {
+    ImageMetadata imageMetadata;
+    const bool imageMetadataOk = readImageMetadata(imageFullPath, &imageMetadata);
+    Settings::knownTags.unite(imageMetadata.tags);
+
+    // Unreadable images are cached as well, so they are not tried over and over
+    QMutexLocker locker(&mutex);
+    cache.insert(imageFullPath, imageMetadata);
+    return imageMetadataOk;
+}
+
+void MetadataCache::loadImageMetadataLater(const QStringList &imageFullPaths)
+{
+    QMutexLocker locker(&mutex);
+    for (const QString &imageFullPath : imageFullPaths) {
+        if (!cache.contains(imageFullPath) && !pendingLoadsSet.contains(imageFullPath)) {
+            pendingLoads.append(imageFullPath);
+            pendingLoadsSet.insert(imageFullPath);
+        }
+    }
+
+    if (!pendingLoads.isEmpty() && !isLoading) {
+        isLoading = true;
+        loaderPool.start(new Loader(this));
+    }
+}
+
+void MetadataCache::processPendingLoads()
+{
+    forever {
+        QString imageFullPath;
+        int loadGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingLoads.isEmpty()) {
+                isLoading = false;
+                return;
+            }
+
+            imageFullPath = pendingLoads.takeFirst();
+            pendingLoadsSet.remove(imageFullPath);
+            // Loaded on demand in the meantime, which is as good for whoever waits for it
+            if (cache.contains(imageFullPath)) {
+                addLoadedImage(imageFullPath, {});
+                continue;
+            }
+            loadGeneration = generation;
+        }
+
+        ImageMetadata imageMetadata;
+        readImageMetadata(imageFullPath, &imageMetadata);
+
+        QMutexLocker locker(&mutex);
+        if (loadGeneration != generation) {
+            continue;
+        }
+        if (cache.contains(imageFullPath)) {
+            addLoadedImage(imageFullPath, {});
+        } else {
+            cache.insert(imageFullPath, imageMetadata);
+            addLoadedImage(imageFullPath, imageMetadata.tags);
+        }
+    }
+}
+
+void MetadataCache::addLoadedImage(const QString &imageFullPath, const QSet<QString> &tags)
+{
+    // Settings::knownTags belongs to the GUI thread
+    loadedTags.unite(tags);
+    loadedImages.append(imageFullPath);
+    if (!isDeliveryScheduled) {
+        isDeliveryScheduled = true;
+        QMetaObject::invokeMethod(this, "deliverLoadedMetadata", Qt::QueuedConnection);
+    }
+}
+
+void MetadataCache::deliverLoadedMetadata()
+{
+    QSet<QString> tags;
+    QStringList images;
+    {
+        QMutexLocker locker(&mutex);
+        tags.swap(loadedTags);
+        images.swap(loadedImages);
+        isDeliveryScheduled = false;
+    }
+
+    const int knownTagsCount = Settings::knownTags.size();
+    Settings::knownTags.unite(tags);
+    if (Settings::knownTags.size() != knownTagsCount) {
+        emit newTagsFound();
+    }
+    if (!images.isEmpty()) {
+        emit imageMetadataLoaded(images);
+    }
+}
+
+long MetadataCache::readImageOrientation(const QString &imageFullPath)
+{
+    ImageMetadata imageMetadata;
+    readImageMetadata(imageFullPath, &imageMetadata);
+    return imageMetadata.orientation;
+}
+
+bool MetadataCache::readImageMetadata(const QString &imageFullPath, ImageMetadata *imageMetadata)
+{
+    PipelineStats::ScopedTimer timer(PipelineStats::ReadMetadata);
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
     Exiv2::Image::AutoPtr exifImage;
 #pragma clang diagnostic pop
 
-    QSet<QString> tags;
-    long orientation = 0;
-
     try {
         exifImage = Exiv2::ImageFactory::open(imageFullPath.toStdString());
         exifImage->readMetadata();
@@ -99,7 +276,7 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath)
         try {
             Exiv2::ExifData::const_iterator it = Exiv2::orientation(exifImage->exifData());
             if (it != exifImage->exifData().end()) {
-                orientation = it->toLong();
+                imageMetadata->orientation = it->toLong();
             }
         } catch (Exiv2::Error &error) {
             qWarning() << "Failed to read Exif metadata" << error.what();
@@ -109,7 +286,6 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath)
         try {
             Exiv2::IptcData &iptcData = exifImage->iptcData();
             if (!iptcData.empty()) {
-                QString key;
                 Exiv2::IptcData::iterator end = iptcData.end();
 
                 // Finds the first ID, but we need to loop over the rest in case there are more
@@ -119,27 +295,12 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath)
                         continue;
                     }
 
-                    QString tagName = QString::fromUtf8(iptcIt->toString().c_str());
-                    tags.insert(tagName);
-                    Settings::knownTags.insert(tagName);
+                    imageMetadata->tags.insert(QString::fromUtf8(iptcIt->toString().c_str()));
                 }
             }
         } catch (Exiv2::Error &error) {
             qWarning() << "Failed to read Iptc metadata";
         }
 
-    ImageMetadata imageMetadata;
-    if (!tags.empty()) {
-        imageMetadata.tags = tags;
-    }
-
-    if (orientation) {
-        imageMetadata.orientation = orientation;
-    }
-
-    if (!tags.empty() || orientation) {
-        cache.insert(imageFullPath, imageMetadata);
-    }
-
     return true;
 }
@@ -19,20 +19,31 @@
 #pragma once
 
 #include <QMap>
+#include <QMutex>
+#include <QObject>
 #include <QSet>
+#include <QStringList>
+#include <QThreadPool>
 
 class ImageMetadata {
 public:
     QSet<QString> tags;
-    long orientation;
+    long orientation = 0;
 };
 
-class MetadataCache {
-private:
-    QMap<QString, ImageMetadata> cache;
+// Tags and orientation of the images in the current directory. Images are added either on
+// demand, when something needs their metadata right away, or in the background through
+// loadImageMetadataLater(). All methods are thread safe, but the ones which may read the file
+// on the spot also update Settings::knownTags and belong on the GUI thread.
+class MetadataCache : public QObject {
+    Q_OBJECT
 
 public:
-    void updateImageTags(const QString &imageFileName, QSet<QString> tags);
+    explicit MetadataCache(QObject *parent = nullptr);
+
+    ~MetadataCache() override;
+
+    void updateImageTags(const QString &imageFileName, const QSet<QString> &tags);
 
     void addTagToImage(const QString &imageFileName, const QString &tagName);
 
@@ -40,13 +51,61 @@ public:
 
     void removeImage(const QString &imageFileName);
 
-    QSet<QString> &getImageTags(const QString &imageFileName);
+    // Reads the metadata first if it is not cached yet
+    QSet<QString> getImageTags(const QString &imageFileName);
 
     void setImageTags(const QString &imageFileName, const QSet<QString> &tags);
 
+    // Also drops all background loads which have not run yet
     void clear();
 
     bool loadImageMetadata(const QString &imageFullPath);
 
+    // Queues the images for loading on a background thread, cached ones are skipped
+    void loadImageMetadataLater(const QStringList &imageFullPaths);
+
+    // Reads the metadata first if it is not cached yet
     long getImageOrientation(const QString &imageFileName);
+
+    // Returns false without touching the file if the metadata is not cached yet
+    bool getCachedImageOrientation(const QString &imageFileName, long *orientation);
+
+    bool isCached(const QString &imageFileName);
+
+    // Reads the orientation without caching anything. Safe to call from any thread.
+    static long readImageOrientation(const QString &imageFullPath);
+
+signals:
+    // Emitted on the GUI thread after background loads turned up tags not in Settings::knownTags
+    void newTagsFound();
+
+    // Emitted on the GUI thread with the images background loads have cached since last time
+    void imageMetadataLoaded(const QStringList &imageFullPaths);
+
+private slots:
+    void deliverLoadedMetadata();
+
+private:
+    class Loader;
+
+    static bool readImageMetadata(const QString &imageFullPath, ImageMetadata *imageMetadata);
+
+    void ensureLoaded(const QString &imageFileName);
+
+    void processPendingLoads();
+
+    // Hands the image and its tags to the GUI thread, called with the mutex held
+    void addLoadedImage(const QString &imageFullPath, const QSet<QString> &tags);
+
+    QMutex mutex;
+    QMap<QString, ImageMetadata> cache;
+    QThreadPool loaderPool;
+    QStringList pendingLoads;
+    QSet<QString> pendingLoadsSet;
+    // Bumped by clear(), so loads already running do not end up in the new cache
+    int generation = 0;
+    bool isLoading = false;
+    QSet<QString> loadedTags;
+    QStringList loadedImages;
+    bool isDeliveryScheduled = false;
 };
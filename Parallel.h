@@ -0,0 +1,94 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QThread>
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Helpers to spread CPU bound work over all cores. The calling thread does its share of the
+// work and all of it is finished when they return, so no thread pool or event loop is involved.
+namespace Parallel {
+
+// Splits [0, count) into one contiguous range per core, none shorter than minChunkSize, and
+// calls function(begin, end) for every range
+template<typename Function>
+void forChunks(int count, int minChunkSize, const Function &function)
+{
+    const int chunks
+        = std::clamp(count / std::max(minChunkSize, 1), 1, QThread::idealThreadCount());
+    if (chunks == 1) {
+        function(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for (int chunk = 1; chunk < chunks; ++chunk) {
+        threads.emplace_back(std::cref(function), int(qint64(count) * chunk / chunks),
+                             int(qint64(count) * (chunk + 1) / chunks));
+    }
+    function(0, int(count / chunks));
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Sorts one chunk per core and merges the sorted chunks pairwise. Like std::sort, not stable.
+template<typename RandomIt, typename Compare>
+void sort(RandomIt first, RandomIt last, Compare lessThan, int minChunkSize = 4096)
+{
+    const int count = int(last - first);
+    const int chunks
+        = std::clamp(count / std::max(minChunkSize, 1), 1, QThread::idealThreadCount());
+    if (chunks == 1) {
+        std::sort(first, last, lessThan);
+        return;
+    }
+
+    std::vector<int> bounds(chunks + 1);
+    for (int chunk = 0; chunk <= chunks; ++chunk) {
+        bounds[chunk] = int(qint64(count) * chunk / chunks);
+    }
+
+    forChunks(chunks, 1, [&](int begin, int end) {
+        for (int chunk = begin; chunk < end; ++chunk) {
+            std::sort(first + bounds[chunk], first + bounds[chunk + 1], lessThan);
+        }
+    });
+
+    for (int width = 1; width < chunks; width *= 2) {
+        const int merges = (chunks + 2 * width - 1) / (2 * width);
+        forChunks(merges, 1, [&](int begin, int end) {
+            for (int merge = begin; merge < end; ++merge) {
+                const int left = merge * 2 * width;
+                const int middle = std::min(left + width, chunks);
+                const int right = std::min(left + 2 * width, chunks);
+                if (middle < right) {
+                    std::inplace_merge(first + bounds[left], first + bounds[middle],
+                                       first + bounds[right], lessThan);
+                }
+            }
+        });
+    }
+}
+}
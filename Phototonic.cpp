@@ -31,6 +31,7 @@
 #include "ImageViewer.h"
 #include "InfoViewer.h"
 #include "MessageBox.h"
+#include "PipelineStats.h"
 #include "ProgressDialog.h"
 #include "RangeInputDialog.h"
 #include "RenameDialog.h"
@@ -53,10 +54,10 @@
 #include <QProcess>
 #include <QScrollBar>
 #include <QSignalBlocker>
-#include <QStandardItem>
 #include <QStandardPaths>
 #include <QStatusBar>
 #include <QToolBar>
+#include <QToolTip>
 
 Phototonic::Phototonic(const QStringList &argumentsList, int filesStartAt, QWidget *parent)
     : QMainWindow(parent)
@@ -164,6 +165,19 @@ bool Phototonic::event(QEvent *event)
     return QMainWindow::event(event);
 }
 
+bool Phototonic::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == statusLabel && event->type() == QEvent::ToolTip) {
+        const QString stats = PipelineStats::summary();
+        if (!stats.isEmpty()) {
+            QToolTip::showText(static_cast<QHelpEvent *>(event)->globalPos(), stats, statusLabel);
+        }
+        return true;
+    }
+
+    return QMainWindow::eventFilter(watched, event);
+}
+
 void Phototonic::createThumbsViewer()
 {
     metadataCache = std::make_shared<MetadataCache>();
@@ -1064,6 +1078,7 @@ void Phototonic::setToolbarIconSize()
 void Phototonic::createStatusBar()
 {
     statusLabel = new QLabel(tr("Initializing..."));
+    statusLabel->installEventFilter(this);
     statusBar()->addWidget(statusLabel);
 
     busyMovie = new QMovie(QStringLiteral(":/images/busy.gif"));
@@ -1303,9 +1318,7 @@ void Phototonic::runExternalApp()
             }
 
             for (int tn = selectedIdxList.size() - 1; tn >= 0; --tn) {
-                arguments += thumbsViewer->thumbsViewerModel->item(selectedIdxList[tn].row())
-                                 ->data(thumbsViewer->FileNameRole)
-                                 .toString();
+                arguments += thumbsViewer->thumbsViewerModel->filePath(selectedIdxList[tn].row());
             }
         }
     }
@@ -1453,9 +1466,7 @@ void Phototonic::copyOrCutThumbs(bool isCopyOperation)
     QList<QUrl> urlList;
     for (int thumb = 0; thumb < copyCutThumbsCount; ++thumb) {
         const QString filePath =
-            thumbsViewer->thumbsViewerModel->item(Settings::copyCutIndexList[thumb].row())
-                ->data(thumbsViewer->FileNameRole)
-                .toString();
+            thumbsViewer->thumbsViewerModel->filePath(Settings::copyCutIndexList[thumb].row());
         Settings::copyCutFileList.append(filePath);
 
         urlList.append(QUrl::fromLocalFile(
@@ -1962,9 +1973,7 @@ void Phototonic::loadCurrentImage(int currentRow)
     }
 
     if (thumbsViewer->getNextRow() < 0 && currentRow > 0) {
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(currentRow - 1)
-                                   ->data(thumbsViewer->FileNameRole)
-                                   .toString());
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(currentRow - 1));
     } else {
         if (thumbsViewer->thumbsViewerModel->rowCount() == 0) {
             hideViewer();
@@ -1975,9 +1984,7 @@ void Phototonic::loadCurrentImage(int currentRow)
         if (currentRow > (thumbsViewer->thumbsViewerModel->rowCount() - 1))
             currentRow = thumbsViewer->thumbsViewerModel->rowCount() - 1;
 
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(currentRow)
-                                   ->data(thumbsViewer->FileNameRole)
-                                   .toString());
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(currentRow));
     }
 
     Settings::wrapImageList = wrapImageListTmp;
@@ -2027,9 +2034,8 @@ void Phototonic::deleteImages(bool trash)
     int row;
     QModelIndexList indexesList;
     while (!(indexesList = thumbsViewer->selectionModel()->selectedIndexes()).empty()) {
-        QString fileNameFullPath = thumbsViewer->thumbsViewerModel->item(indexesList.first().row())
-                                       ->data(thumbsViewer->FileNameRole)
-                                       .toString();
+        QString fileNameFullPath =
+            thumbsViewer->thumbsViewerModel->filePath(indexesList.first().row());
 
         // Only show if it takes a lot of time, since popping this up for just
         // deleting a single image is annoying
@@ -2394,6 +2400,18 @@ void Phototonic::writeSettings()
                                     (bool)Settings::showViewerToolbar);
     Settings::appSettings->setValue(Settings::optionSetWindowIcon, (bool)Settings::setWindowIcon);
     Settings::appSettings->setValue(Settings::optionUpscalePreview, (bool)Settings::upscalePreview);
+    Settings::appSettings->setValue(Settings::optionThumbsCacheSize, Settings::thumbsCacheSize);
+    Settings::appSettings->setValue(Settings::optionImageCacheSize, Settings::imageCacheSize);
+    Settings::appSettings->setValue(Settings::optionThumbsPackedStore,
+                                    Settings::thumbsPackedStore);
+    Settings::appSettings->setValue(Settings::optionDirectoryScanThreads,
+                                    Settings::directoryScanThreads);
+    Settings::appSettings->setValue(Settings::optionDuplicateHashDistance,
+                                    Settings::duplicateHashDistance);
+    Settings::appSettings->setValue(Settings::optionExactDuplicatesOnly,
+                                    Settings::exactDuplicatesOnly);
+    Settings::appSettings->setValue(Settings::optionDuplicateHashMethod,
+                                    Settings::duplicateHashMethod);
 
     /* Action shortcuts */
     Settings::appSettings->beginGroup(Settings::optionShortcuts);
@@ -2516,6 +2534,8 @@ void Phototonic::readSettings()
     Settings::flipV = false;
     Settings::defaultSaveQuality =
         Settings::appSettings->value(Settings::optionDefaultSaveQuality).toInt();
+    Settings::imageCacheSize =
+        Settings::appSettings->value(Settings::optionImageCacheSize, 512).toInt();
     Settings::slideShowDelay = Settings::appSettings->value(Settings::optionSlideShowDelay).toInt();
     Settings::slideShowRandom =
         Settings::appSettings->value(Settings::optionSlideShowRandom).toBool();
@@ -2936,8 +2956,7 @@ void Phototonic::viewImage()
                 return;
             }
 
-            selectedImageIndex = thumbsViewer->thumbsViewerModel->indexFromItem(
-                thumbsViewer->thumbsViewerModel->item(0));
+            selectedImageIndex = thumbsViewer->thumbsViewerModel->index(0, 0);
             thumbsViewer->selectionModel()->select(selectedImageIndex, QItemSelectionModel::Toggle);
             thumbsViewer->setCurrentRow(0);
         }
@@ -3052,9 +3071,8 @@ void Phototonic::loadSelectedThumbImage(const QModelIndex &idx)
 {
     thumbsViewer->setCurrentRow(idx.row());
     showViewer();
-    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(idx.row())
-                               ->data(thumbsViewer->FileNameRole)
-                               .toString());
+    prefetchImagesAround(idx.row());
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(idx.row()));
     thumbsViewer->setImageViewerWindowTitle();
 }
 
@@ -3122,9 +3140,8 @@ void Phototonic::slideShowHandler()
             loadRandomImage();
         } else {
             int currentRow = thumbsViewer->getCurrentRow();
-            imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(currentRow)
-                                       ->data(thumbsViewer->FileNameRole)
-                                       .toString());
+            prefetchImagesAround(currentRow);
+            imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(currentRow));
             thumbsViewer->setImageViewerWindowTitle();
 
             if (thumbsViewer->getNextRow() > 0) {
@@ -3140,6 +3157,35 @@ void Phototonic::slideShowHandler()
     }
 }
 
+void Phototonic::prefetchImagesAround(int row)
+{
+    // Images on either side, enough to page through at the speed of keyboard autorepeat
+    const int prefetchDistance = 2;
+
+    const int rowCount = thumbsViewer->thumbsViewerModel->rowCount();
+    if (Settings::layoutMode != ImageViewWidget || row < 0 || row >= rowCount) {
+        return;
+    }
+
+    QStringList filePaths;
+    filePaths.append(thumbsViewer->thumbsViewerModel->filePath(row));
+    for (int distance = 1; distance <= prefetchDistance; ++distance) {
+        for (int neighbour : {row + distance, row - distance}) {
+            if (Settings::wrapImageList) {
+                neighbour = (neighbour % rowCount + rowCount) % rowCount;
+            } else if (neighbour < 0 || neighbour >= rowCount) {
+                continue;
+            }
+
+            const QString filePath = thumbsViewer->thumbsViewerModel->filePath(neighbour);
+            if (!filePaths.contains(filePath)) {
+                filePaths.append(filePath);
+            }
+        }
+    }
+    imageViewer->prefetchImages(filePaths);
+}
+
 void Phototonic::loadNextImage()
 {
     if (thumbsViewer->thumbsViewerModel->rowCount() <= 0) {
@@ -3156,9 +3202,8 @@ void Phototonic::loadNextImage()
     }
 
     if (Settings::layoutMode == ImageViewWidget) {
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(nextThumb)
-                                   ->data(thumbsViewer->FileNameRole)
-                                   .toString());
+        prefetchImagesAround(nextThumb);
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(nextThumb));
     }
 
     thumbsViewer->setCurrentRow(nextThumb);
@@ -3185,9 +3230,8 @@ void Phototonic::loadPreviousImage()
     }
 
     if (Settings::layoutMode == ImageViewWidget) {
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(previousThumb)
-                                   ->data(thumbsViewer->FileNameRole)
-                                   .toString());
+        prefetchImagesAround(previousThumb);
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(previousThumb));
     }
 
     thumbsViewer->setCurrentRow(previousThumb);
@@ -3204,8 +3248,8 @@ void Phototonic::loadFirstImage()
         return;
     }
 
-    imageViewer->loadImage(
-        thumbsViewer->thumbsViewerModel->item(0)->data(thumbsViewer->FileNameRole).toString());
+    prefetchImagesAround(0);
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(0));
     thumbsViewer->setCurrentRow(0);
     thumbsViewer->setImageViewerWindowTitle();
 
@@ -3221,9 +3265,8 @@ void Phototonic::loadLastImage()
     }
 
     int lastRow = thumbsViewer->getLastRow();
-    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(lastRow)
-                               ->data(thumbsViewer->FileNameRole)
-                               .toString());
+    prefetchImagesAround(lastRow);
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(lastRow));
     thumbsViewer->setCurrentRow(lastRow);
     thumbsViewer->setImageViewerWindowTitle();
 
@@ -3239,9 +3282,7 @@ void Phototonic::loadRandomImage()
     }
 
     int randomRow = thumbsViewer->getRandomRow();
-    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(randomRow)
-                               ->data(thumbsViewer->FileNameRole)
-                               .toString());
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(randomRow));
     thumbsViewer->setCurrentRow(randomRow);
     thumbsViewer->setImageViewerWindowTitle();
 
@@ -3608,10 +3649,8 @@ void Phototonic::rename()
             currentFileInfo.absolutePath() + QDir::separator() + newFileName;
         if (currentFileFullPath.rename(newFileNameFullPath)) {
             QModelIndexList indexesList = thumbsViewer->selectionModel()->selectedIndexes();
-            thumbsViewer->thumbsViewerModel->item(indexesList.first().row())
-                ->setData(newFileNameFullPath, thumbsViewer->FileNameRole);
-            thumbsViewer->thumbsViewerModel->item(indexesList.first().row())
-                ->setData(newFileName, Qt::DisplayRole);
+            thumbsViewer->thumbsViewerModel->setFilePath(indexesList.first().row(),
+                                                         newFileNameFullPath);
 
             imageViewer->setInfo(newFileName);
             imageViewer->viewerImageFullPath = newFileNameFullPath;
@@ -3644,9 +3683,7 @@ void Phototonic::removeMetadata()
     copyCutThumbsCount = indexList.size();
 
     for (int thumb = 0; thumb < copyCutThumbsCount; ++thumb) {
-        fileList.append(thumbsViewer->thumbsViewerModel->item(indexList[thumb].row())
-                            ->data(thumbsViewer->FileNameRole)
-                            .toString());
+        fileList.append(thumbsViewer->thumbsViewerModel->filePath(indexList[thumb].row()));
     }
 
     if (fileList.isEmpty()) {
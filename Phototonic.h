@@ -69,6 +69,9 @@ protected:
 
     void keyPressEvent(QKeyEvent *event);
 
+    // Shows the PipelineStats as the tooltip of the status bar, put together when asked for
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
 public slots:
 
     bool event(QEvent *event);
@@ -486,6 +489,9 @@ private:
 
     void loadCurrentImage(int currentRow);
 
+    // Has the viewer decode the image in the row and its neighbours in the background
+    void prefetchImagesAround(int row);
+
     void selectCurrentViewDir();
 
     void processStartupArguments(const QStringList &argumentsList, int filesStartAt);
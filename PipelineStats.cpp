@@ -0,0 +1,227 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PipelineStats.h"
+
+#include <QDebug>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStringList>
+#include <QtAlgorithms>
+
+#include <atomic>
+
+namespace { // anonymous, not visible outside of this file
+
+// Buckets per power of two
+const int subBuckets = 4;
+const int bucketCount = 64 * subBuckets;
+
+struct StageStats
+{
+    std::atomic<quint64> count;
+    std::atomic<quint64> total;
+    std::atomic<quint64> max;
+    std::atomic<quint64> buckets[bucketCount];
+};
+
+// Zero initialized, being static
+StageStats stageStats[PipelineStats::StageCount];
+std::atomic<quint64> counters[PipelineStats::CounterCount];
+
+const char *const stageKeys[PipelineStats::StageCount] = {
+    "listDirectory",   "showFirstRows",       "readMetadata", "lookupPack",
+    "locateThumbnail", "readEmbeddedPreview", "decodeImage",  "cropThumbnail",
+    "computeHistogram", "storeThumbnail"};
+
+const char *const stageNames[PipelineStats::StageCount] = {
+    "List directory",   "First rows shown", "Read metadata", "Packed store", "Locate thumbnail",
+    "Embedded preview", "Decode",           "Smart crop",    "Histogram",    "Store thumbnail"};
+
+int bucketIndex(quint64 nanoseconds)
+{
+    if (nanoseconds < subBuckets) {
+        return int(nanoseconds);
+    }
+    const int highestBit = 63 - qCountLeadingZeroBits(nanoseconds);
+    const int subBucket = int(nanoseconds >> (highestBit - 2)) & (subBuckets - 1);
+    return highestBit * subBuckets + subBucket;
+}
+
+quint64 bucketStart(int index)
+{
+    // The buckets below 2 * subBuckets besides the first few are never used
+    if (index < 2 * subBuckets) {
+        return quint64(index);
+    }
+    return quint64(subBuckets + index % subBuckets) << (index / subBuckets - 2);
+}
+
+// The middle of the bucket holding the given fraction of all recorded times
+double percentile(const StageStats &stats, double fraction)
+{
+    const quint64 count = stats.count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+
+    const quint64 rank = qMax(quint64(1), quint64(fraction * double(count) + 0.5));
+    quint64 seen = 0;
+    for (int index = 0; index < bucketCount; ++index) {
+        seen += stats.buckets[index].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            if (index + 1 == bucketCount) {
+                return double(bucketStart(index));
+            }
+            return (double(bucketStart(index)) + double(bucketStart(index + 1))) / 2;
+        }
+    }
+    return double(stats.max.load(std::memory_order_relaxed));
+}
+
+QString formatDuration(double nanoseconds)
+{
+    if (nanoseconds >= 1e9) {
+        return QString::number(nanoseconds / 1e9, 'f', 2) + QStringLiteral(" s");
+    }
+    if (nanoseconds >= 1e6) {
+        return QString::number(nanoseconds / 1e6, 'f', 1) + QStringLiteral(" ms");
+    }
+    return QString::number(nanoseconds / 1e3, 'f', 1) + QStringLiteral(" µs");
+}
+
+// Hits and misses of one cache, both of the same counter pair
+struct CacheCounters
+{
+    const char *key;
+    const char *name;
+    PipelineStats::Counter hits;
+    PipelineStats::Counter misses;
+};
+
+const CacheCounters caches[] = {
+    {"memoryCache", "Memory cache", PipelineStats::MemoryCacheHit, PipelineStats::MemoryCacheMiss},
+    {"packedStore", "Packed store", PipelineStats::PackHit, PipelineStats::PackMiss},
+    {"sharedStore", "Thumbnail store", PipelineStats::SharedStoreHit,
+     PipelineStats::SharedStoreMiss},
+    {"imageCache", "Image prefetch", PipelineStats::ImageCacheHit,
+     PipelineStats::ImageCacheMiss}};
+} // namespace
+
+namespace PipelineStats {
+
+const char *stageKey(Stage stage)
+{
+    return stageKeys[stage];
+}
+
+void record(Stage stage, qint64 nanoseconds)
+{
+    StageStats &stats = stageStats[stage];
+    const quint64 duration = quint64(qMax(nanoseconds, qint64(0)));
+    stats.count.fetch_add(1, std::memory_order_relaxed);
+    stats.total.fetch_add(duration, std::memory_order_relaxed);
+    stats.buckets[bucketIndex(duration)].fetch_add(1, std::memory_order_relaxed);
+
+    quint64 max = stats.max.load(std::memory_order_relaxed);
+    while (duration > max
+           && !stats.max.compare_exchange_weak(max, duration, std::memory_order_relaxed)) {
+    }
+}
+
+void increment(Counter counter)
+{
+    counters[counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+QString summary()
+{
+    QStringList lines;
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const StageStats &stats = stageStats[stage];
+        const quint64 count = stats.count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        lines.append(QStringLiteral("%1: %2 calls, %3 total, p50 %4, p99 %5")
+                         .arg(QLatin1String(stageNames[stage]))
+                         .arg(count)
+                         .arg(formatDuration(double(stats.total.load(std::memory_order_relaxed))))
+                         .arg(formatDuration(percentile(stats, 0.5)))
+                         .arg(formatDuration(percentile(stats, 0.99))));
+    }
+
+    for (const CacheCounters &cache : caches) {
+        const quint64 hits = counters[cache.hits].load(std::memory_order_relaxed);
+        const quint64 lookups = hits + counters[cache.misses].load(std::memory_order_relaxed);
+        if (lookups > 0) {
+            lines.append(QStringLiteral("%1: %2% hits of %3")
+                             .arg(QLatin1String(cache.name))
+                             .arg(QString::number(100.0 * double(hits) / double(lookups), 'f', 1))
+                             .arg(lookups));
+        }
+    }
+    return lines.join(QLatin1Char('\n'));
+}
+
+QJsonObject toJson()
+{
+    QJsonObject stages;
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const StageStats &stats = stageStats[stage];
+        const quint64 count = stats.count.load(std::memory_order_relaxed);
+        const double total = double(stats.total.load(std::memory_order_relaxed));
+        QJsonObject stageObject;
+        stageObject.insert(QStringLiteral("count"), double(count));
+        stageObject.insert(QStringLiteral("totalMs"), total / 1e6);
+        stageObject.insert(QStringLiteral("meanUs"), count ? total / double(count) / 1e3 : 0.0);
+        stageObject.insert(QStringLiteral("p50Us"), percentile(stats, 0.5) / 1e3);
+        stageObject.insert(QStringLiteral("p99Us"), percentile(stats, 0.99) / 1e3);
+        stageObject.insert(QStringLiteral("maxUs"),
+                           double(stats.max.load(std::memory_order_relaxed)) / 1e3);
+        stages.insert(QLatin1String(stageKeys[stage]), stageObject);
+    }
+
+    QJsonObject cacheObjects;
+    for (const CacheCounters &cache : caches) {
+        const quint64 hits = counters[cache.hits].load(std::memory_order_relaxed);
+        const quint64 misses = counters[cache.misses].load(std::memory_order_relaxed);
+        QJsonObject cacheObject;
+        cacheObject.insert(QStringLiteral("hits"), double(hits));
+        cacheObject.insert(QStringLiteral("misses"), double(misses));
+        cacheObject.insert(QStringLiteral("hitRate"),
+                           hits + misses ? double(hits) / double(hits + misses) : 0.0);
+        cacheObjects.insert(QLatin1String(cache.key), cacheObject);
+    }
+
+    QJsonObject stats;
+    stats.insert(QStringLiteral("stages"), stages);
+    stats.insert(QStringLiteral("caches"), cacheObjects);
+    return stats;
+}
+
+bool writeJson(const QString &filePath)
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write pipeline statistics to" << filePath << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(toJson()).toJson());
+    return file.commit();
+}
+}
@@ -0,0 +1,97 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Trace.h"
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+
+// Counters and timing histograms for the stages of the thumbnail pipeline, from listing a
+// directory to storing the thumbnail. Always compiled in: recording costs a few relaxed atomic
+// additions and is safe from any thread. Timings are kept in buckets a quarter of a power of two
+// wide, which is fine enough for percentiles.
+namespace PipelineStats {
+
+enum Stage
+{
+    // Per directory
+    ListDirectory,
+    // From the start of listing a directory until its first rows are in the view
+    ShowFirstRows,
+    // Exiv2, for the EXIF orientation and the metadata cache
+    ReadMetadata,
+    LookupPack,
+    // locateThumbnail(), stat()s in the freedesktop thumbnail store
+    LocateThumbnail,
+    ReadEmbeddedPreview,
+    // Reading the scaled image, or the stored thumbnail if there is one
+    DecodeImage,
+    CropThumbnail,
+    ComputeHistogram,
+    // Encoding and writing a thumbnail to the freedesktop store, on the writer threads
+    StoreThumbnail,
+    StageCount
+};
+
+enum Counter
+{
+    MemoryCacheHit,
+    MemoryCacheMiss,
+    PackHit,
+    PackMiss,
+    SharedStoreHit,
+    SharedStoreMiss,
+    // Decoded images prefetched for the viewer
+    ImageCacheHit,
+    ImageCacheMiss,
+    CounterCount
+};
+
+// The name of the stage in the JSON output and in traces
+const char *stageKey(Stage stage);
+
+void record(Stage stage, qint64 nanoseconds);
+
+void increment(Counter counter);
+
+// Records the time from its construction to its destruction, and traces it as well
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage) : stage(stage), trace(stageKey(stage)) { timer.start(); }
+
+    ~ScopedTimer() { record(stage, timer.nsecsElapsed()); }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    Stage stage;
+    Trace::Scope trace;
+    QElapsedTimer timer;
+};
+
+// One line per stage and cache, for a tooltip
+QString summary();
+
+QJsonObject toJson();
+
+// Returns false if the file could not be written
+bool writeJson(const QString &filePath);
+}
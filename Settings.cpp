@@ -69,6 +69,13 @@ const char optionKnownTags[] = "KnownTags";
 const char optionSetWindowIcon[] = "setWindowIcon";
 const char optionUpscalePreview[] = "upscalePreview";
 const char optionScrollZooms[] = "scrollZooms";
+const char optionThumbsCacheSize[] = "thumbsCacheSize";
+const char optionThumbsPackedStore[] = "thumbsPackedStore";
+const char optionDirectoryScanThreads[] = "directoryScanThreads";
+const char optionDuplicateHashDistance[] = "duplicateHashDistance";
+const char optionExactDuplicatesOnly[] = "exactDuplicatesOnly";
+const char optionDuplicateHashMethod[] = "duplicateHashMethod";
+const char optionImageCacheSize[] = "imageCacheSize";
 
 QSettings *appSettings;
 unsigned int layoutMode;
@@ -154,4 +161,11 @@ bool isFileListLoaded;
 bool setWindowIcon;
 bool upscalePreview;
 bool scrollZooms;
+int thumbsCacheSize;
+bool thumbsPackedStore;
+int directoryScanThreads;
+int duplicateHashDistance;
+bool exactDuplicatesOnly;
+int duplicateHashMethod;
+int imageCacheSize;
 }
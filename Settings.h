@@ -86,6 +86,13 @@ extern const char optionKnownTags[];
 extern const char optionSetWindowIcon[];
 extern const char optionUpscalePreview[];
 extern const char optionScrollZooms[];
+extern const char optionThumbsCacheSize[];
+extern const char optionThumbsPackedStore[];
+extern const char optionDirectoryScanThreads[];
+extern const char optionDuplicateHashDistance[];
+extern const char optionExactDuplicatesOnly[];
+extern const char optionDuplicateHashMethod[];
+extern const char optionImageCacheSize[];
 
 extern QSettings *appSettings;
 extern unsigned int layoutMode;
@@ -171,4 +178,15 @@ extern bool isFileListLoaded;
 extern bool setWindowIcon;
 extern bool upscalePreview;
 extern bool scrollZooms;
+extern int thumbsCacheSize;
+extern bool thumbsPackedStore;
+extern int directoryScanThreads;
+// Bits in which the image hashes of duplicates may differ, 0 only finds identical hashes
+extern int duplicateHashDistance;
+// Find byte identical files only, without decoding any image
+extern bool exactDuplicatesOnly;
+// An ImageHash::Method
+extern int duplicateHashMethod;
+// Megabytes of decoded images kept around the current one in the viewer, 0 disables prefetching
+extern int imageCacheSize;
 }
@@ -17,8 +17,11 @@
  */
 
 #include "SettingsDialog.h"
+#include "ImageHash.h"
+#include "ImageHashIndex.h"
 #include "Settings.h"
 #include "ShortcutsTable.h"
+#include "ThumbnailCache.h"
 
 #include <QColorDialog>
 #include <QFileDialog>
@@ -95,6 +98,19 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     saveQualityHbox->addWidget(saveQualitySpinBox);
     saveQualityHbox->addStretch(1);
 
+    // Decoded images kept for next and previous
+    QLabel *imageCacheSizeLabel = new QLabel(tr("Image prefetch memory:"));
+    imageCacheSizeSpinBox = new QSpinBox;
+    imageCacheSizeSpinBox->setRange(0, 8192);
+    imageCacheSizeSpinBox->setSingleStep(64);
+    imageCacheSizeSpinBox->setSuffix(tr(" MB"));
+    imageCacheSizeSpinBox->setSpecialValueText(tr("Disabled"));
+    imageCacheSizeSpinBox->setValue(Settings::imageCacheSize);
+    QHBoxLayout *imageCacheSizeHbox = new QHBoxLayout;
+    imageCacheSizeHbox->addWidget(imageCacheSizeLabel);
+    imageCacheSizeHbox->addWidget(imageCacheSizeSpinBox);
+    imageCacheSizeHbox->addStretch(1);
+
     // Enable animations
     enableAnimCheckBox = new QCheckBox(tr("Enable GIF animation"), this);
     enableAnimCheckBox->setChecked(Settings::enableAnimations);
@@ -123,6 +139,7 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     viewerOptsBox->addWidget(wrapListCheckBox);
     viewerOptsBox->addWidget(enableAnimCheckBox);
     viewerOptsBox->addLayout(saveQualityHbox);
+    viewerOptsBox->addLayout(imageCacheSizeHbox);
     viewerOptsBox->addStretch(1);
 
     // thumbsViewer background color
@@ -187,6 +204,53 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     thumbPagesReadLayout->addWidget(thumbPagesSpinBox);
     thumbPagesReadLayout->addStretch(1);
 
+    // Memory used for keeping thumbnails across directories
+    QLabel *thumbsCacheSizeLabel = new QLabel(tr("Thumbnail memory cache:"));
+    thumbsCacheSizeSpinBox = new QSpinBox;
+    thumbsCacheSizeSpinBox->setRange(0, 4096);
+    thumbsCacheSizeSpinBox->setSingleStep(64);
+    thumbsCacheSizeSpinBox->setSuffix(tr(" MB"));
+    thumbsCacheSizeSpinBox->setValue(Settings::thumbsCacheSize);
+    QHBoxLayout *thumbsCacheSizeLayout = new QHBoxLayout;
+    thumbsCacheSizeLayout->addWidget(thumbsCacheSizeLabel);
+    thumbsCacheSizeLayout->addWidget(thumbsCacheSizeSpinBox);
+    thumbsCacheSizeLayout->addStretch(1);
+
+    // Keep this low for spinning disks, they only get slower with more readers
+    QLabel *directoryScanThreadsLabel = new QLabel(tr("Folders read in parallel with subfolders:"));
+    directoryScanThreadsSpinBox = new QSpinBox;
+    directoryScanThreadsSpinBox->setRange(1, 32);
+    directoryScanThreadsSpinBox->setValue(Settings::directoryScanThreads);
+    QHBoxLayout *directoryScanThreadsLayout = new QHBoxLayout;
+    directoryScanThreadsLayout->addWidget(directoryScanThreadsLabel);
+    directoryScanThreadsLayout->addWidget(directoryScanThreadsSpinBox);
+    directoryScanThreadsLayout->addStretch(1);
+
+    // Higher values also find resized and recompressed copies, and more false duplicates
+    QLabel *duplicateHashDistanceLabel = new QLabel(tr("Tolerance when finding duplicate images:"));
+    duplicateHashDistanceSpinBox = new QSpinBox;
+    duplicateHashDistanceSpinBox->setRange(0, ImageHashIndex::maxSearchDistance);
+    duplicateHashDistanceSpinBox->setValue(Settings::duplicateHashDistance);
+    QHBoxLayout *duplicateHashDistanceLayout = new QHBoxLayout;
+    duplicateHashDistanceLayout->addWidget(duplicateHashDistanceLabel);
+    duplicateHashDistanceLayout->addWidget(duplicateHashDistanceSpinBox);
+    duplicateHashDistanceLayout->addStretch(1);
+
+    exactDuplicatesOnlyCheckBox =
+        new QCheckBox(tr("Only find identical files when finding duplicate images"), this);
+    exactDuplicatesOnlyCheckBox->setChecked(Settings::exactDuplicatesOnly);
+
+    // Slower, but also finds copies with changed contrast, small crops or watermarks
+    dctDuplicateHashCheckBox =
+        new QCheckBox(tr("Compare frequencies instead of gradients when finding duplicate images"),
+                      this);
+    dctDuplicateHashCheckBox->setChecked(Settings::duplicateHashMethod == ImageHash::DctHash);
+
+    // Private per directory thumbnail packs in front of the shared freedesktop thumbnails
+    thumbsPackedStoreCheckBox =
+        new QCheckBox(tr("Store thumbnails in a private per folder cache"), this);
+    thumbsPackedStoreCheckBox->setChecked(Settings::thumbsPackedStore);
+
     enableThumbExifCheckBox =
         new QCheckBox(tr("Rotate thumbnail according to Exif orientation value"), this);
     enableThumbExifCheckBox->setChecked(Settings::exifThumbRotationEnabled);
@@ -205,6 +269,12 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     thumbsOptsBox->addLayout(thumbsLabelColorLayout);
     thumbsOptsBox->addWidget(enableThumbExifCheckBox);
     thumbsOptsBox->addLayout(thumbPagesReadLayout);
+    thumbsOptsBox->addLayout(thumbsCacheSizeLayout);
+    thumbsOptsBox->addLayout(directoryScanThreadsLayout);
+    thumbsOptsBox->addLayout(duplicateHashDistanceLayout);
+    thumbsOptsBox->addWidget(exactDuplicatesOnlyCheckBox);
+    thumbsOptsBox->addWidget(dctDuplicateHashCheckBox);
+    thumbsOptsBox->addWidget(thumbsPackedStoreCheckBox);
     thumbsOptsBox->addWidget(upscalePreviewCheckBox);
     thumbsOptsBox->addStretch(1);
 
@@ -384,6 +454,16 @@ void SettingsDialog::saveSettings()
     Settings::thumbsBackgroundImage = thumbsBackgroundImageLineEdit->text();
     Settings::thumbsRepeatBackgroundImage = thumbsRepeatBackgroundImageCheckBox->isChecked();
     Settings::thumbsPagesReadCount = (unsigned int)thumbPagesSpinBox->value();
+    Settings::thumbsCacheSize = thumbsCacheSizeSpinBox->value();
+    ThumbnailCache::setMaxSize(Settings::thumbsCacheSize);
+    Settings::imageCacheSize = imageCacheSizeSpinBox->value();
+    Settings::thumbsPackedStore = thumbsPackedStoreCheckBox->isChecked();
+    Settings::directoryScanThreads = directoryScanThreadsSpinBox->value();
+    Settings::duplicateHashDistance = duplicateHashDistanceSpinBox->value();
+    Settings::exactDuplicatesOnly = exactDuplicatesOnlyCheckBox->isChecked();
+    Settings::duplicateHashMethod = dctDuplicateHashCheckBox->isChecked()
+        ? ImageHash::DctHash
+        : ImageHash::DifferenceHash;
     Settings::wrapImageList = wrapListCheckBox->isChecked();
     Settings::defaultSaveQuality = saveQualitySpinBox->value();
     Settings::slideShowDelay = slideDelaySpinBox->value();
@@ -57,7 +57,11 @@ private:
     QToolButton *thumbsColorPickerButton;
     QToolButton *thumbsLabelColorButton;
     QSpinBox *thumbPagesSpinBox;
+    QSpinBox *thumbsCacheSizeSpinBox;
+    QSpinBox *directoryScanThreadsSpinBox;
+    QSpinBox *duplicateHashDistanceSpinBox;
     QSpinBox *saveQualitySpinBox;
+    QSpinBox *imageCacheSizeSpinBox;
     QColor imageViewerBackgroundColor;
     QColor thumbsBackgroundColor;
     QColor thumbsTextColor;
@@ -65,6 +69,9 @@ private:
     QCheckBox *enableAnimCheckBox;
     QCheckBox *enableExifCheckBox;
     QCheckBox *enableThumbExifCheckBox;
+    QCheckBox *thumbsPackedStoreCheckBox;
+    QCheckBox *exactDuplicatesOnlyCheckBox;
+    QCheckBox *dctDuplicateHashCheckBox;
     QCheckBox *showImageNameCheckBox;
     QCheckBox *reverseMouseCheckBox;
     QCheckBox *scrollZoomCheckBox;
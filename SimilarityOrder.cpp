@@ -0,0 +1,236 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SimilarityOrder.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace { // anonymous, not visible outside of this file
+// Neighbouring bins are merged, the ordering hardly changes but the distances get 8 times cheaper
+const int featureBins = 32;
+const int binsPerFeatureBin = 256 / featureBins;
+
+// The square roots of the normalized histogram bins. With those, the Bhattacharyya coefficient
+// of two histograms is a dot product, and the distance of Histogram::compare() is the sum of
+// the Euclidean distances per channel, up to a constant factor.
+struct Feature
+{
+    float channels[3][featureBins];
+};
+
+Feature featureOf(const Histogram &histogram)
+{
+    Feature feature;
+    const quint16 *channels[3] = {histogram.red, histogram.green, histogram.blue};
+    for (int channel = 0; channel < 3; ++channel) {
+        float total = 0;
+        for (int bin = 0; bin < featureBins; ++bin) {
+            float sum = 0;
+            for (int i = 0; i < binsPerFeatureBin; ++i) {
+                sum += channels[channel][bin * binsPerFeatureBin + i];
+            }
+            feature.channels[channel][bin] = sum;
+            total += sum;
+        }
+
+        for (float &value : feature.channels[channel]) {
+            value = total > 0 ? std::sqrt(value / total) : 0;
+        }
+    }
+    return feature;
+}
+
+float distance(const Feature &a, const Feature &b)
+{
+    float result = 0;
+    for (int channel = 0; channel < 3; ++channel) {
+        float sum = 0;
+        for (int bin = 0; bin < featureBins; ++bin) {
+            const float difference = a.channels[channel][bin] - b.channels[channel][bin];
+            sum += difference * difference;
+        }
+        result += std::sqrt(sum);
+    }
+    return result;
+}
+
+// Vantage point tree which supports removing points, so nearest neighbour queries only find
+// the images which are not part of the chain yet
+class VantagePointTree {
+public:
+    explicit VantagePointTree(const std::vector<Feature> &features)
+        : features(features)
+        , nodes(features.size())
+        , nodeOfPoint(features.size())
+    {
+        std::vector<int> points(features.size());
+        std::iota(points.begin(), points.end(), 0);
+        std::vector<float> distances(features.size());
+        root = build(points, distances, 0, int(points.size()), -1);
+    }
+
+    void remove(int point)
+    {
+        for (int node = nodeOfPoint[point]; node >= 0; node = nodes[node].parent) {
+            --nodes[node].remaining;
+        }
+        nodes[nodeOfPoint[point]].isRemoved = true;
+    }
+
+    // Returns the closest point which has not been removed, or -1 if there is none
+    int nearest(const Feature &query) const
+    {
+        int best = -1;
+        float bestDistance = std::numeric_limits<float>::max();
+        search(root, query, &best, &bestDistance);
+        return best;
+    }
+
+private:
+    struct Node
+    {
+        int point = -1;
+        int parent = -1;
+        int inside = -1;
+        int outside = -1;
+        // Points in the subtree which have not been removed yet, this one included
+        int remaining = 0;
+        bool isRemoved = false;
+        float radius = 0;
+    };
+
+    // Builds the subtree of points[begin, end) in nodes[begin], its children take the nodes of
+    // their points in turn
+    int build(std::vector<int> &points, std::vector<float> &distances, int begin, int end,
+              int parent)
+    {
+        if (begin >= end) {
+            return -1;
+        }
+
+        Node &node = nodes[begin];
+        node.point = points[begin];
+        node.parent = parent;
+        node.remaining = end - begin;
+        nodeOfPoint[node.point] = begin;
+
+        const int first = begin + 1;
+        if (first == end) {
+            return begin;
+        }
+
+        // Distances to the vantage point are the expensive part, large subsets share them out
+        const Feature &vantagePoint = features[node.point];
+        Parallel::forChunks(end - first, 2048, [&](int chunkBegin, int chunkEnd) {
+            for (int i = first + chunkBegin; i < first + chunkEnd; ++i) {
+                distances[points[i]] = distance(vantagePoint, features[points[i]]);
+            }
+        });
+
+        const int middle = first + (end - first) / 2;
+        std::nth_element(points.begin() + first, points.begin() + middle, points.begin() + end,
+                         [&](int a, int b) { return distances[a] < distances[b]; });
+        const float radius = distances[points[middle]];
+
+        // node is not touched below, the recursion would invalidate a reference anyway
+        const int inside = build(points, distances, first, middle, begin);
+        const int outside = build(points, distances, middle, end, begin);
+        nodes[begin].radius = radius;
+        nodes[begin].inside = inside;
+        nodes[begin].outside = outside;
+        return begin;
+    }
+
+    void search(int nodeIndex, const Feature &query, int *best, float *bestDistance) const
+    {
+        if (nodeIndex < 0 || nodes[nodeIndex].remaining == 0) {
+            return;
+        }
+
+        const Node &node = nodes[nodeIndex];
+        const float nodeDistance = distance(query, features[node.point]);
+        if (!node.isRemoved && nodeDistance < *bestDistance) {
+            *best = node.point;
+            *bestDistance = nodeDistance;
+        }
+
+        // Points inside are at most radius away from the vantage point, the others at least
+        if (nodeDistance < node.radius) {
+            search(node.inside, query, best, bestDistance);
+            if (nodeDistance + *bestDistance >= node.radius) {
+                search(node.outside, query, best, bestDistance);
+            }
+        } else {
+            search(node.outside, query, best, bestDistance);
+            if (nodeDistance - *bestDistance <= node.radius) {
+                search(node.inside, query, best, bestDistance);
+            }
+        }
+    }
+
+    const std::vector<Feature> &features;
+    std::vector<Node> nodes;
+    std::vector<int> nodeOfPoint;
+    int root = -1;
+};
+}
+
+namespace SimilarityOrder {
+
+QVector<int> order(const QVector<std::shared_ptr<const Histogram>> &histograms,
+                   const std::function<bool(int)> &progress)
+{
+    const int count = histograms.size();
+    if (count == 0) {
+        return {};
+    }
+
+    Trace::Scope trace("SimilarityOrder::order", QString::number(count));
+
+    std::vector<Feature> features(count);
+    Parallel::forChunks(count, 256, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            features[i] = featureOf(*histograms.at(i));
+        }
+    });
+
+    VantagePointTree tree(features);
+
+    QVector<int> chain;
+    chain.reserve(count);
+    int current = 0;
+    tree.remove(current);
+    chain.append(current);
+    while (chain.size() < count) {
+        current = tree.nearest(features[current]);
+        tree.remove(current);
+        chain.append(current);
+
+        if (progress && chain.size() % 256 == 0 && !progress(chain.size())) {
+            return {};
+        }
+    }
+
+    return chain;
+}
+}
@@ -0,0 +1,39 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <QVector>
+
+#include <functional>
+#include <memory>
+
+// Orders images so that every image is followed by the most similar one of those left, starting
+// with the first. This is the greedy nearest neighbour chain over Histogram::compare(), which is
+// a sum of Hellinger distances and therefore a metric. Instead of comparing all pairs, the
+// histograms are reduced to compact feature vectors and indexed in a vantage point tree, and
+// the next image in the chain is the result of a nearest neighbour query in that tree.
+namespace SimilarityOrder {
+
+// Returns the indices of histograms in chain order. progress is called with the length of the
+// chain every now and then, the ordering is abandoned and an empty vector returned when it
+// returns false.
+QVector<int> order(const QVector<std::shared_ptr<const Histogram>> &histograms,
+                   const std::function<bool(int)> &progress = {});
+}
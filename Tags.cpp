@@ -65,6 +65,9 @@ ImageTags::ImageTags(QWidget *parent, ThumbsViewer *thumbsViewer,
     connect(tagsTree, &QTreeWidget::itemChanged, this, &ImageTags::saveLastChangedTag);
     connect(tagsTree, &QTreeWidget::itemClicked, this, &ImageTags::tagClicked);
 
+    // Tags of images read in the background show up after the directory has been listed
+    connect(metadataCache.get(), &MetadataCache::newTagsFound, this, &ImageTags::populateTagsTree);
+
     tagsTree->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(tagsTree, &QTreeWidget::customContextMenuRequested, this, &ImageTags::showMenu);
 
@@ -151,7 +154,7 @@ void ImageTags::addTag(const QString &tagName, bool tagChecked)
     tagsTree->addTopLevelItem(tagItem);
 }
 
-bool ImageTags::writeTagsToImage(const QString &imageFileName, QSet<QString> &newTags)
+bool ImageTags::writeTagsToImage(const QString &imageFileName, const QSet<QString> &newTags)
 {
     QSet<QString> imageTags;
 
@@ -74,7 +74,7 @@ public:
     TagsDisplayMode currentDisplayMode;
 
 private:
-    bool writeTagsToImage(const QString &imageFileName, QSet<QString> &tags);
+    bool writeTagsToImage(const QString &imageFileName, const QSet<QString> &tags);
 
     QSet<QString> getCheckedTags(Qt::CheckState tagState);
 
@@ -0,0 +1,71 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailCache.h"
+#include "PipelineStats.h"
+
+#include <QCache>
+
+namespace ThumbnailCache {
+
+// Costs are counted in kilobytes, so large budgets still fit into QCache's int
+static QCache<QString, Entry> &cache()
+{
+    static QCache<QString, Entry> entries(256 * 1024);
+    return entries;
+}
+
+QString key(const QString &filePath, const QDateTime &lastModified, qint64 size, int thumbSize,
+            unsigned int layout)
+{
+    return filePath + QLatin1Char('\n') + QString::number(lastModified.toMSecsSinceEpoch())
+        + QLatin1Char('\n') + QString::number(size) + QLatin1Char('\n')
+        + QString::number(thumbSize) + QLatin1Char('\n') + QString::number(layout);
+}
+
+bool find(const QString &key, Entry *entry)
+{
+    const Entry *cached = cache().object(key);
+    if (cached == nullptr) {
+        PipelineStats::increment(PipelineStats::MemoryCacheMiss);
+        return false;
+    }
+
+    PipelineStats::increment(PipelineStats::MemoryCacheHit);
+
+    *entry = *cached;
+    return true;
+}
+
+void insert(const QString &key, const Entry &entry)
+{
+    const qint64 bytes = qint64(entry.pixmap.width()) * entry.pixmap.height()
+            * entry.pixmap.depth() / 8
+        + sizeof(Entry) + (entry.histogram ? sizeof(Histogram) : 0);
+    cache().insert(key, new Entry(entry), int(qMax<qint64>(1, bytes / 1024)));
+}
+
+void setMaxSize(int megabytes)
+{
+    cache().setMaxCost(megabytes * 1024);
+}
+
+void clear()
+{
+    cache().clear();
+}
+}
@@ -0,0 +1,49 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <QDateTime>
+#include <QPixmap>
+
+#include <memory>
+
+// Thumbnails kept in memory for the whole process, so they survive directory switches.
+// Entries are evicted in least recently used order once the budget is exceeded.
+// QPixmap is involved, so everything here must be called from the GUI thread.
+namespace ThumbnailCache {
+
+struct Entry
+{
+    QPixmap pixmap;
+    qreal brightness = 0;
+    std::shared_ptr<const Histogram> histogram;
+};
+
+QString key(const QString &filePath, const QDateTime &lastModified, qint64 size, int thumbSize,
+            unsigned int layout);
+
+bool find(const QString &key, Entry *entry);
+
+void insert(const QString &key, const Entry &entry);
+
+void setMaxSize(int megabytes);
+
+void clear();
+}
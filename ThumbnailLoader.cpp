@@ -0,0 +1,529 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailLoader.h"
+#include "ImageViewer.h"
+#include "PipelineStats.h"
+#include "SmartCrop.h"
+#include "ThumbnailPack.h"
+#include "ThumbnailWriter.h"
+#include "ThumbsViewer.h"
+#include "Trace.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QImageReader>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QUrl>
+
+#include <algorithm>
+#include <exiv2/exiv2.hpp>
+
+// Exiv2 reads the metadata only, the pixels are left to Qt or the preview manager
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+static void openExifImage(const QString &filePath, Exiv2::Image::AutoPtr *exifImage)
+{
+    try {
+        *exifImage = Exiv2::ImageFactory::open(filePath.toStdString());
+        (*exifImage)->readMetadata();
+    } catch (Exiv2::Error &) {
+        exifImage->reset();
+        return;
+    }
+
+    if (!(*exifImage)->good()) {
+        exifImage->reset();
+    }
+}
+#pragma clang diagnostic pop
+
+static long readExifOrientation(Exiv2::Image &exifImage)
+{
+    if (!exifImage.supportsMetadata(Exiv2::mdExif)) {
+        return 0;
+    }
+
+    try {
+        Exiv2::ExifData::const_iterator it = Exiv2::orientation(exifImage.exifData());
+        if (it != exifImage.exifData().end()) {
+            return it->toLong();
+        }
+    } catch (Exiv2::Error &error) {
+        qWarning() << "Failed to read Exif metadata" << error.what();
+    }
+    return 0;
+}
+
+// Whether Qt could decode the image itself, so an embedded preview is only a stand-in
+static bool isDecodableByQt(const Exiv2::Image &exifImage)
+{
+    static const QList<QByteArray> supportedMimeTypes = QImageReader::supportedMimeTypes();
+    return supportedMimeTypes.contains(QByteArray::fromStdString(exifImage.mimeType()));
+}
+
+static bool runsLater(const ThumbnailRequest &a, const ThumbnailRequest &b)
+{
+    if (a.priority != b.priority) {
+        return a.priority > b.priority;
+    }
+    return a.sequence > b.sequence;
+}
+
+class ThumbnailLoader::Worker : public QRunnable {
+public:
+    explicit Worker(ThumbnailLoader *loader)
+        : loader(loader)
+    {
+    }
+
+    void run() override
+    {
+        loader->processRequests();
+    }
+
+private:
+    ThumbnailLoader *loader;
+};
+
+ThumbnailLoader::ThumbnailLoader(QObject *parent)
+    : QObject(parent)
+{
+    // Not thread safe, so it has to happen before the workers start reading embedded previews
+    Exiv2::XmpParser::initialize();
+}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+    cancelPending();
+    threadPool.waitForDone();
+    ThumbnailWriter::waitForDone();
+}
+
+void ThumbnailLoader::enqueue(const ThumbnailRequest &request)
+{
+    QMutexLocker locker(&mutex);
+    pendingRequests.push_back(request);
+    pendingRequests.back().sequence = nextSequence++;
+    std::push_heap(pendingRequests.begin(), pendingRequests.end(), runsLater);
+
+    if (activeWorkers < threadPool.maxThreadCount()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+QVector<ThumbnailRequest> ThumbnailLoader::cancelPending()
+{
+    QMutexLocker locker(&mutex);
+    QVector<ThumbnailRequest> cancelled(pendingRequests.begin(), pendingRequests.end());
+    pendingRequests.clear();
+    return cancelled;
+}
+
+QVector<ThumbnailRequest>
+ThumbnailLoader::reschedule(const std::function<int(const ThumbnailRequest &)> &priorityOf)
+{
+    QMutexLocker locker(&mutex);
+    QVector<ThumbnailRequest> cancelled;
+    std::vector<ThumbnailRequest> kept;
+    kept.reserve(pendingRequests.size());
+
+    for (ThumbnailRequest &request : pendingRequests) {
+        const int priority = priorityOf(request);
+        if (priority >= 0) {
+            request.priority = priority;
+        } else if (request.cancellable) {
+            cancelled.append(request);
+            continue;
+        }
+        kept.push_back(std::move(request));
+    }
+
+    pendingRequests.swap(kept);
+    std::make_heap(pendingRequests.begin(), pendingRequests.end(), runsLater);
+    return cancelled;
+}
+
+void ThumbnailLoader::processRequests()
+{
+    forever {
+        ThumbnailRequest request;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingRequests.empty()) {
+                --activeWorkers;
+                return;
+            }
+            std::pop_heap(pendingRequests.begin(), pendingRequests.end(), runsLater);
+            request = std::move(pendingRequests.back());
+            pendingRequests.pop_back();
+        }
+
+        ThumbnailResult result = loadThumbnail(request);
+
+        QMutexLocker locker(&mutex);
+        finishedResults.append(result);
+
+        // Results pile up until the GUI thread gets around to picking them up
+        if (!isDeliveryScheduled) {
+            isDeliveryScheduled = true;
+            QMetaObject::invokeMethod(this, "deliverResults", Qt::QueuedConnection);
+        }
+    }
+}
+
+void ThumbnailLoader::deliverResults()
+{
+    QVector<ThumbnailResult> results;
+    {
+        QMutexLocker locker(&mutex);
+        results.swap(finishedResults);
+        isDeliveryScheduled = false;
+    }
+
+    if (!results.isEmpty()) {
+        emit thumbnailsReady(results);
+    }
+}
+
+ThumbnailResult ThumbnailLoader::loadThumbnail(const ThumbnailRequest &request)
+{
+    Trace::Scope trace("ThumbnailLoader::loadThumbnail", request.filePath);
+    ThumbnailResult result;
+    result.filePath = request.filePath;
+    result.generation = request.generation;
+    result.lastModified = request.lastModified;
+    result.fileSize = request.fileSize;
+
+    QImage thumb;
+    std::shared_ptr<ThumbnailPack> pack;
+    if (request.usePackedStore) {
+        PipelineStats::ScopedTimer timer(PipelineStats::LookupPack);
+        pack = ThumbnailPack::forDirectory(QFileInfo(request.filePath).absolutePath());
+        pack->find(request.filePath, request.lastModified, request.fileSize, request.thumbSize,
+                   request.layout, &thumb);
+        PipelineStats::increment(thumb.isNull() ? PipelineStats::PackMiss
+                                                : PipelineStats::PackHit);
+    }
+
+    // Opened at most once, the preview and the orientation both come from its metadata
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    Exiv2::Image::AutoPtr exifImage;
+#pragma clang diagnostic pop
+    bool isExifImageOpened = false;
+    const auto openedExifImage = [&]() -> Exiv2::Image * {
+        if (!isExifImageOpened) {
+            isExifImageOpened = true;
+            openExifImage(request.filePath, &exifImage);
+        }
+        return exifImage.get();
+    };
+
+    if (thumb.isNull()) {
+        if (request.allowEmbeddedPreview && openedExifImage()) {
+            thumb = readEmbeddedPreview(*exifImage, request);
+            // Formats Qt can not decode, like most RAW files, have nothing better than the preview
+            result.isPreview = !thumb.isNull() && isDecodableByQt(*exifImage);
+        }
+
+        if (thumb.isNull()) {
+            // The freedesktop store stays behind the pack, it is shared with other applications
+            // and survives the pack being reset
+            thumb = readThumbnail(request, true);
+        }
+
+        if (thumb.isNull() && !request.allowEmbeddedPreview && openedExifImage()) {
+            thumb = readEmbeddedPreview(*exifImage, request);
+        }
+
+        if (pack && !result.isPreview) {
+            pack->insert(request.filePath, request.lastModified, request.fileSize,
+                         request.thumbSize, request.layout, thumb);
+        }
+    }
+
+    if (thumb.isNull()) {
+        return result;
+    }
+
+    long orientation = request.orientation;
+    if (request.readOrientation) {
+        PipelineStats::ScopedTimer timer(PipelineStats::ReadMetadata);
+        orientation = openedExifImage() ? readExifOrientation(*exifImage) : 0;
+    }
+    if (orientation) {
+        ImageViewer::rotateByExifOrientation(thumb, orientation);
+    }
+
+    // From the whole image, so sorting by brightness or similarity does not depend on the
+    // thumbnail layout
+    {
+        PipelineStats::ScopedTimer timer(PipelineStats::ComputeHistogram);
+        result.histogram =
+            std::make_shared<const Histogram>(Histogram::fromImage(thumb, &result.brightness));
+    }
+
+    if (request.layout != ThumbsViewer::Classic) {
+        PipelineStats::ScopedTimer timer(PipelineStats::CropThumbnail);
+        thumb = SmartCrop::crop(thumb, QSize(request.thumbSize, request.thumbSize));
+    }
+    result.image = thumb;
+    result.ok = true;
+    return result;
+}
+
+QImage ThumbnailLoader::readThumbnail(const ThumbnailRequest &request, bool useSharedStore)
+{
+    const QString &imageFileName = request.filePath;
+    const int thumbSize = request.thumbSize;
+    const Qt::AspectRatioMode aspectRatioMode = request.layout != ThumbsViewer::Classic
+        ? Qt::KeepAspectRatioByExpanding
+        : Qt::KeepAspectRatio;
+
+    QImageReader thumbReader;
+    QImage thumb;
+    bool imageReadOk = false;
+    bool shouldStoreThumbnail = false;
+
+    thumbReader.setFileName(imageFileName);
+    thumbReader.setQuality(
+        50); // 50 is the threshold where Qt does fast decoding, but still good scaling
+    const QSize origThumbSize = thumbReader.size();
+    QSize currentThumbSize = origThumbSize;
+
+    if (useSharedStore) {
+        QString thumbnailPath = locateThumbnail(imageFileName, thumbSize);
+        if (!thumbnailPath.isEmpty()) {
+            if (QImageReader(thumbnailPath).canRead()) {
+                thumbReader.setFileName(thumbnailPath);
+            } else {
+                qWarning() << "Invalid thumbnail" << thumbnailPath;
+                shouldStoreThumbnail = true;
+            }
+        } else {
+            shouldStoreThumbnail = true;
+        }
+    }
+
+    if (currentThumbSize.isValid()) {
+        if (currentThumbSize.width() != thumbSize || currentThumbSize.height() != thumbSize) {
+            currentThumbSize.scale(QSize(thumbSize, thumbSize), aspectRatioMode);
+        }
+
+        PipelineStats::ScopedTimer timer(PipelineStats::DecodeImage);
+        thumbReader.setScaledSize(currentThumbSize);
+        imageReadOk = thumbReader.read(&thumb);
+
+        if (imageReadOk && useSharedStore && !shouldStoreThumbnail) {
+            int w = thumb.text(QStringLiteral("Thumb::Image::Width")).toInt();
+            int h = thumb.text(QStringLiteral("Thumb::Image::Height")).toInt();
+            if (origThumbSize != QSize(w, h)) {
+                qWarning() << "Invalid size in stored thumbnail" << w << h << "vs" << origThumbSize;
+                shouldStoreThumbnail = true;
+                thumbReader.setFileName(imageFileName);
+                imageReadOk = thumbReader.read(&thumb);
+            }
+        }
+    }
+
+    if (useSharedStore) {
+        PipelineStats::increment(shouldStoreThumbnail ? PipelineStats::SharedStoreMiss
+                                                      : PipelineStats::SharedStoreHit);
+    }
+
+    if (!imageReadOk) {
+        return QImage();
+    }
+
+    if (shouldStoreThumbnail) {
+        storeThumbnail(imageFileName, thumb, origThumbSize);
+    }
+
+    return thumb;
+}
+
+QImage ThumbnailLoader::readEmbeddedPreview(Exiv2::Image &exifImage,
+                                            const ThumbnailRequest &request)
+{
+    PipelineStats::ScopedTimer timer(PipelineStats::ReadEmbeddedPreview);
+    const Qt::AspectRatioMode aspectRatioMode = request.layout != ThumbsViewer::Classic
+        ? Qt::KeepAspectRatioByExpanding
+        : Qt::KeepAspectRatio;
+    const QSize imageSize(exifImage.pixelWidth(), exifImage.pixelHeight());
+
+    QImage preview;
+    try {
+        Exiv2::PreviewManager previewManager(exifImage);
+        // Sorted by size, smallest first
+        const Exiv2::PreviewPropertiesList previews = previewManager.getPreviewProperties();
+        for (const Exiv2::PreviewProperties &properties : previews) {
+            const QSize previewSize(properties.width_, properties.height_);
+            if (previewSize.isEmpty()) {
+                continue;
+            }
+
+            if (!imageSize.isEmpty()) {
+                // Small EXIF thumbnails are often letterboxed to 160x120 regardless of the image
+                const qreal imageAspect = qreal(imageSize.width()) / imageSize.height();
+                const qreal previewAspect = qreal(previewSize.width()) / previewSize.height();
+                if (qAbs(imageAspect - previewAspect) > imageAspect * 0.02) {
+                    continue;
+                }
+            }
+
+            const QSize neededSize = previewSize.scaled(request.thumbSize, request.thumbSize,
+                                                        aspectRatioMode);
+            if (previewSize.width() < neededSize.width()
+                || previewSize.height() < neededSize.height()) {
+                continue;
+            }
+
+            const Exiv2::PreviewImage previewImage = previewManager.getPreviewImage(properties);
+            if (preview.loadFromData(previewImage.pData(), int(previewImage.size()))) {
+                break;
+            }
+        }
+    } catch (Exiv2::Error &error) {
+        qWarning() << "Error reading embedded preview" << error.what();
+        return QImage();
+    }
+
+    if (preview.isNull()) {
+        return preview;
+    }
+
+    return preview.scaled(request.thumbSize, request.thumbSize, aspectRatioMode,
+                          Qt::SmoothTransformation);
+}
+
+QString ThumbnailLoader::thumbnailFileName(const QString &originalPath)
+{
+    QFileInfo info(originalPath);
+    QString canonicalPath = info.canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << originalPath << "does not exist!";
+        canonicalPath = info.absoluteFilePath();
+    }
+    QUrl url = QUrl::fromLocalFile(canonicalPath);
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
+    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
+}
+
+QString ThumbnailLoader::locateThumbnail(const QString &originalPath, int thumbSize)
+{
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return "";
+#endif
+    PipelineStats::ScopedTimer timer(PipelineStats::LocateThumbnail);
+    QStringList folders = {
+        QStringLiteral("xx-large/"), // max 1024px
+        QStringLiteral("x-large/"), // max 512px
+        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
+    };
+
+    if (thumbSize <= 200) {
+        folders.append(QStringLiteral("normal/")); // 128px max
+    }
+
+    const QString filename = thumbnailFileName(originalPath);
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/thumbnails/");
+    const QFileInfo originalInfo(originalPath);
+    for (const QString &folder : folders) {
+        QFileInfo info(basePath + folder + filename);
+        if (!info.exists()) {
+            continue;
+        }
+        if (originalInfo.metadataChangeTime() > info.lastModified()) {
+            continue;
+        }
+        if (originalInfo.lastModified() > info.lastModified()) {
+            continue;
+        }
+        return info.absoluteFilePath();
+    }
+    return QString();
+}
+
+void ThumbnailLoader::storeThumbnail(const QString &originalPath, const QImage &thumbnail,
+                                     const QSize &originalSize)
+{
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return;
+#endif
+    const QString canonicalPath = QFileInfo(originalPath).canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << "Asked to store thumbnail for non-existent path" << originalPath;
+        return;
+    }
+
+    QString folder = QStringLiteral("normal/");
+    int folderSize = 128;
+    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
+    if (maxSize < 64) {
+        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
+        return;
+    }
+    if (maxSize >= 1024) {
+        folder = QStringLiteral("xx-large/");
+        folderSize = 1024;
+    } else if (maxSize >= 512) {
+        folder = QStringLiteral("x-large/");
+        folderSize = 512;
+    } else if (maxSize >= 256) {
+        folder = QStringLiteral("large/");
+        folderSize = 256;
+    } else if (maxSize >= 128) {
+        folder = QStringLiteral("normal/");
+        folderSize = 128;
+    } else {
+        qWarning() << "Thumbnail too small" << thumbnail.size();
+        return;
+    }
+
+    const QString filename = thumbnailFileName(originalPath);
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/thumbnails/");
+
+    if (!QFileInfo::exists(basePath + folder)) {
+        QDir().mkpath(basePath + folder);
+    }
+
+    const QString fullPath = basePath + folder + filename;
+    QFileInfo info(fullPath);
+
+    QDateTime lastModified = info.lastModified();
+    if (info.metadataChangeTime() > info.lastModified()) {
+        lastModified = info.metadataChangeTime();
+    }
+    QMap<QString, QString> texts;
+    texts.insert(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toTime_t()));
+
+    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
+    texts.insert(QStringLiteral("Thumb::URI"), url.url());
+
+    texts.insert(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
+    texts.insert(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
+    texts.insert(QStringLiteral("Software"), QStringLiteral("Phototonic"));
+
+    ThumbnailWriter::enqueue(fullPath, thumbnail, folderSize, texts);
+}
@@ -0,0 +1,134 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <QDateTime>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Exiv2 {
+class Image;
+}
+
+struct ThumbnailRequest
+{
+    QString filePath;
+    int thumbSize = 0;
+    unsigned int layout = 0;
+    // EXIF orientation to apply, 0 to leave the image as it is
+    long orientation = 0;
+    // The orientation is not known yet and has to be read from the image by the worker
+    bool readOrientation = false;
+    int generation = 0;
+    // Lower values are decoded first
+    int priority = 0;
+    // Requests which are not cancellable survive reschedule() even when they leave the window
+    bool cancellable = true;
+    quint64 sequence = 0;
+    // Look up and store the thumbnail in the per directory pack, in front of the freedesktop store
+    bool usePackedStore = false;
+    QDateTime lastModified;
+    qint64 fileSize = 0;
+    // Accept a large enough embedded EXIF/RAW preview instead of decoding the whole image
+    bool allowEmbeddedPreview = false;
+    // Full decode replacing a thumbnail which came from an embedded preview
+    bool isRefinement = false;
+};
+
+struct ThumbnailResult
+{
+    QString filePath;
+    QImage image;
+    qreal brightness = 0;
+    std::shared_ptr<const Histogram> histogram;
+    bool ok = false;
+    int generation = 0;
+    // Of the file as it was requested, to recognize results for a file changed since
+    QDateTime lastModified;
+    qint64 fileSize = 0;
+    // The image is an embedded preview and a full decode would give a better thumbnail
+    bool isPreview = false;
+};
+
+// Decodes thumbnails on a pool of worker threads. Workers always pick the pending request
+// with the lowest priority value. Finished thumbnails are collected and handed back to the
+// GUI thread in batches through thumbnailsReady().
+class ThumbnailLoader : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ThumbnailLoader(QObject *parent = nullptr);
+
+    ~ThumbnailLoader() override;
+
+    void enqueue(const ThumbnailRequest &request);
+
+    // Drops all requests which have not been picked up by a worker yet and returns them
+    QVector<ThumbnailRequest> cancelPending();
+
+    // Assigns new priorities to the pending requests. Cancellable requests for which
+    // priorityOf() returns a negative value are dropped and returned.
+    QVector<ThumbnailRequest>
+    reschedule(const std::function<int(const ThumbnailRequest &)> &priorityOf);
+
+    // Does the actual decoding, scaling, rotation and cropping. Safe to call from any thread.
+    static ThumbnailResult loadThumbnail(const ThumbnailRequest &request);
+
+    // Reads the scaled image, from the freedesktop thumbnail store if useSharedStore is set
+    static QImage readThumbnail(const ThumbnailRequest &request, bool useSharedStore);
+
+    static QString thumbnailFileName(const QString &originalPath);
+
+    static QString locateThumbnail(const QString &originalPath, int thumbSize);
+
+    // Queues the thumbnail for the freedesktop thumbnail store, see ThumbnailWriter
+    static void storeThumbnail(const QString &originalPath, const QImage &thumbnail,
+                               const QSize &originalSize);
+
+signals:
+    void thumbnailsReady(const QVector<ThumbnailResult> &results);
+
+private slots:
+    void deliverResults();
+
+private:
+    class Worker;
+
+    // Extracts the smallest embedded preview still covering the thumbnail from the opened image
+    static QImage readEmbeddedPreview(Exiv2::Image &exifImage, const ThumbnailRequest &request);
+
+    void processRequests();
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    // Binary heap ordered by priority, then by insertion order
+    std::vector<ThumbnailRequest> pendingRequests;
+    quint64 nextSequence = 0;
+    QVector<ThumbnailResult> finishedResults;
+    int activeWorkers = 0;
+    bool isDeliveryScheduled = false;
+};
@@ -0,0 +1,453 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailPack.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <iterator>
+
+#if defined(Q_OS_UNIX)
+#include <sys/stat.h>
+#endif
+
+namespace { // anonymous, not visible outside of this file
+// Version 01 did not keep the layout, its packs are started over
+const char packMagic[8] = {'P', 'T', 'P', 'A', 'C', 'K', '0', '2'};
+const quint32 recordMagic = 0x50545452;
+const int maxOpenPacks = 16;
+// A pack mapped in more pieces than this as it grows is mapped again as a whole
+const int maxMappedRegions = 8;
+// Only packs at least this large and mostly made of replaced records get compacted
+const qint64 compactThreshold = 4 * 1024 * 1024;
+
+enum RecordFormat : quint32
+{
+    JpegRecord = 0,
+    RawRecord = 1 // ARGB32 premultiplied, for images with an alpha channel
+};
+
+// Each record is this header, followed by the UTF-8 image path and the image data
+struct RecordHeader
+{
+    quint32 magic;
+    quint32 format;
+    qint64 lastModified;
+    qint64 fileSize;
+    qint32 thumbSize;
+    qint32 width;
+    qint32 height;
+    quint32 pathLength;
+    quint32 dataLength;
+    // A ThumbsViewer::ThumbnailLayouts value
+    quint32 layout;
+};
+
+// Without inodes a pack compacted by another process is only noticed when it is opened again
+quint64 fileInode(const QString &filePath)
+{
+#if defined(Q_OS_UNIX)
+    QT_STATBUF status;
+    if (QT_STAT(QFile::encodeName(filePath).constData(), &status) == 0) {
+        return quint64(status.st_ino);
+    }
+#else
+    Q_UNUSED(filePath)
+#endif
+    return 0;
+}
+}
+
+std::shared_ptr<ThumbnailPack> ThumbnailPack::forDirectory(const QString &directoryPath)
+{
+    static QMutex packsMutex;
+    // Every pack still alive, so a file never gets opened and indexed twice
+    static QHash<QString, std::weak_ptr<ThumbnailPack>> packs;
+    // Keeps the packs used last open, the others only live as long as a worker holds them
+    static QList<std::shared_ptr<ThumbnailPack>> recentlyUsed;
+
+    QMutexLocker locker(&packsMutex);
+    std::shared_ptr<ThumbnailPack> pack = packs.value(directoryPath).lock();
+    if (pack) {
+        recentlyUsed.removeOne(pack);
+        recentlyUsed.append(pack);
+        return pack;
+    }
+
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/phototonic/packs/");
+    if (!QFileInfo::exists(basePath)) {
+        QDir().mkpath(basePath);
+    }
+
+    const QByteArray hash = QCryptographicHash::hash(QFile::encodeName(directoryPath),
+                                                     QCryptographicHash::Md5)
+                                .toHex();
+    pack = std::make_shared<ThumbnailPack>(basePath + QString::fromLatin1(hash)
+                                           + QStringLiteral(".pack"));
+
+    for (auto it = packs.begin(); it != packs.end();) {
+        it = it->expired() ? packs.erase(it) : std::next(it);
+    }
+    packs.insert(directoryPath, pack);
+    recentlyUsed.append(pack);
+    if (recentlyUsed.size() > maxOpenPacks) {
+        recentlyUsed.removeFirst();
+    }
+
+    return pack;
+}
+
+ThumbnailPack::ThumbnailPack(const QString &packFilePath)
+    : file(packFilePath)
+    , lockFile(packFilePath + QStringLiteral(".lock"))
+{
+    isOpen = open();
+}
+
+ThumbnailPack::~ThumbnailPack()
+{
+    unmapAll();
+}
+
+QString ThumbnailPack::indexKey(const QString &imagePath, int thumbSize, unsigned int layout)
+{
+    return imagePath + QLatin1Char('\n') + QString::number(thumbSize) + QLatin1Char('\n')
+        + QString::number(layout);
+}
+
+bool ThumbnailPack::open()
+{
+    if (!lockFile.lock()) {
+        qWarning() << "Failed to lock thumbnail pack" << file.fileName();
+        return false;
+    }
+    const auto unlock = qScopeGuard([this] { lockFile.unlock(); });
+    return openLocked();
+}
+
+bool ThumbnailPack::openLocked()
+{
+    // In append mode the records of different processes can only ever follow each other
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qWarning() << "Failed to open thumbnail pack" << file.fileName() << file.errorString();
+        return false;
+    }
+    inode = fileInode(file.fileName());
+
+    char magic[sizeof(packMagic)];
+    if (!file.seek(0) || file.read(magic, sizeof(magic)) != sizeof(magic)
+        || memcmp(magic, packMagic, sizeof(magic)) != 0) {
+        file.resize(0);
+        file.write(packMagic, sizeof(packMagic));
+        file.flush();
+    }
+
+    mappedEnd = sizeof(packMagic);
+    scan();
+
+    if (file.size() > compactThreshold && liveBytes * 2 < file.size()) {
+        return compact();
+    }
+
+    return true;
+}
+
+bool ThumbnailPack::reopen()
+{
+    unmapAll();
+    file.close();
+    isOpen = openLocked();
+    return isOpen;
+}
+
+void ThumbnailPack::scan()
+{
+    const qint64 fileSize = file.size();
+    const qint64 start = sizeof(packMagic);
+    qint64 pos = start;
+
+    index.clear();
+    liveBytes = 0;
+
+    const uchar *data = fileSize > start ? mapRecord(start, fileSize - start) : nullptr;
+    while (data != nullptr && pos + qint64(sizeof(RecordHeader)) <= fileSize) {
+        RecordHeader header;
+        memcpy(&header, data + (pos - start), sizeof(header));
+        if (header.magic != recordMagic) {
+            break;
+        }
+
+        const qint64 recordLength = sizeof(header) + qint64(header.pathLength) + header.dataLength;
+        if (pos + recordLength > fileSize) {
+            break;
+        }
+
+        const QString imagePath = QString::fromUtf8(
+            reinterpret_cast<const char *>(data + (pos - start) + sizeof(header)),
+            int(header.pathLength));
+        const QString key = indexKey(imagePath, header.thumbSize, header.layout);
+
+        // Later records replace earlier ones of the same image
+        const auto previous = index.constFind(key);
+        if (previous != index.constEnd()) {
+            liveBytes -= previous->length;
+        }
+        index.insert(key, {pos, recordLength, header.lastModified, header.fileSize});
+        liveBytes += recordLength;
+        pos += recordLength;
+    }
+
+    if (pos < fileSize) {
+        // Every append holds the lock file, so this is a write that got interrupted and not one
+        // still going on. Nobody else is using the mappings yet.
+        qWarning() << "Dropping damaged tail of thumbnail pack" << file.fileName();
+        unmapAll();
+        file.resize(pos);
+    }
+}
+
+bool ThumbnailPack::compact()
+{
+    QSaveFile compacted(file.fileName());
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        return true;
+    }
+
+    compacted.write(packMagic, sizeof(packMagic));
+    for (const IndexEntry &entry : qAsConst(index)) {
+        const uchar *record = mapRecord(entry.offset, entry.length);
+        if (record == nullptr) {
+            return true;
+        }
+        compacted.write(reinterpret_cast<const char *>(record), entry.length);
+    }
+
+    unmapAll();
+    file.close();
+
+    if (!compacted.commit()) {
+        qWarning() << "Failed to compact thumbnail pack" << file.fileName();
+    }
+
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        return false;
+    }
+    inode = fileInode(file.fileName());
+    scan();
+    return true;
+}
+
+const uchar *ThumbnailPack::mapRecord(qint64 offset, qint64 length)
+{
+    if (offset + length > mappedEnd) {
+        const qint64 fileSize = file.size();
+        if (offset + length > fileSize) {
+            return nullptr;
+        }
+
+        if (mappedRegions.size() >= maxMappedRegions) {
+            retireRegions();
+        }
+
+        // Indexed records are always written completely before anything gets mapped past their
+        // start, so none of them ever spans two regions
+        uchar *data = file.map(mappedEnd, fileSize - mappedEnd);
+        if (data == nullptr) {
+            qWarning() << "Failed to map thumbnail pack" << file.fileName() << file.errorString();
+            return nullptr;
+        }
+        mappedRegions.append({mappedEnd, fileSize - mappedEnd, data});
+        mappedEnd = fileSize;
+    }
+
+    for (const MappedRegion &region : qAsConst(mappedRegions)) {
+        if (offset >= region.offset && offset + length <= region.offset + region.size) {
+            return region.data + (offset - region.offset);
+        }
+    }
+
+    return nullptr;
+}
+
+void ThumbnailPack::retireRegions()
+{
+    if (activeReaders > 0) {
+        retiredRegions.append(mappedRegions);
+    } else {
+        for (const MappedRegion &region : qAsConst(mappedRegions)) {
+            file.unmap(region.data);
+        }
+    }
+    mappedRegions.clear();
+    mappedEnd = sizeof(packMagic);
+}
+
+void ThumbnailPack::releaseReader()
+{
+    QMutexLocker locker(&mutex);
+    if (--activeReaders > 0) {
+        return;
+    }
+    for (const MappedRegion &region : qAsConst(retiredRegions)) {
+        file.unmap(region.data);
+    }
+    retiredRegions.clear();
+    readersDone.wakeAll();
+}
+
+void ThumbnailPack::unmapAll()
+{
+    for (const MappedRegion &region : qAsConst(retiredRegions)) {
+        file.unmap(region.data);
+    }
+    retiredRegions.clear();
+    for (const MappedRegion &region : qAsConst(mappedRegions)) {
+        file.unmap(region.data);
+    }
+    mappedRegions.clear();
+    mappedEnd = sizeof(packMagic);
+}
+
+bool ThumbnailPack::find(const QString &imagePath, const QDateTime &lastModified,
+                         qint64 fileSize, int thumbSize, unsigned int layout, QImage *image)
+{
+    const uchar *record;
+    {
+        QMutexLocker locker(&mutex);
+        if (!isOpen) {
+            return false;
+        }
+
+        const auto entry = index.constFind(indexKey(imagePath, thumbSize, layout));
+        if (entry == index.constEnd() || entry->lastModified != lastModified.toMSecsSinceEpoch()
+            || entry->fileSize != fileSize) {
+            return false;
+        }
+
+        record = mapRecord(entry->offset, entry->length);
+        if (record == nullptr) {
+            return false;
+        }
+        ++activeReaders;
+    }
+    const auto release = qScopeGuard([this] { releaseReader(); });
+
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const uchar *data = record + sizeof(header) + header.pathLength;
+
+    if (header.format == RawRecord) {
+        // The data length is bounded by the record, the size is not
+        if (header.width <= 0 || header.height <= 0
+            || qint64(header.dataLength) < qint64(header.width) * header.height * 4) {
+            qWarning() << "Damaged record in thumbnail pack" << file.fileName() << imagePath;
+            return false;
+        }
+        *image = QImage(data, header.width, header.height, header.width * 4,
+                        QImage::Format_ARGB32_Premultiplied)
+                     .copy();
+    } else {
+        image->loadFromData(data, int(header.dataLength), "JPG");
+    }
+
+    return !image->isNull();
+}
+
+void ThumbnailPack::insert(const QString &imagePath, const QDateTime &lastModified,
+                           qint64 fileSize, int thumbSize, unsigned int layout,
+                           const QImage &image)
+{
+    if (image.isNull()) {
+        return;
+    }
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    QByteArray data;
+
+    if (image.hasAlphaChannel()) {
+        const QImage raw = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        header.format = RawRecord;
+        data.reserve(raw.width() * raw.height() * 4);
+        for (int y = 0; y < raw.height(); ++y) {
+            data.append(reinterpret_cast<const char *>(raw.constScanLine(y)), raw.width() * 4);
+        }
+    } else {
+        header.format = JpegRecord;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPG", 90);
+    }
+
+    const QByteArray path = imagePath.toUtf8();
+    header.magic = recordMagic;
+    header.lastModified = lastModified.toMSecsSinceEpoch();
+    header.fileSize = fileSize;
+    header.thumbSize = thumbSize;
+    header.layout = layout;
+    header.width = image.width();
+    header.height = image.height();
+    header.pathLength = path.size();
+    header.dataLength = data.size();
+    const qint64 recordLength = sizeof(header) + qint64(path.size()) + data.size();
+
+    QMutexLocker locker(&mutex);
+    if (fileInode(file.fileName()) != inode) {
+        // Another process compacted the pack, the readers of the old file go first. Only done
+        // before taking the lock file, which the other threads wait for with the mutex held.
+        while (activeReaders > 0) {
+            readersDone.wait(&mutex);
+        }
+    }
+    if (!isOpen) {
+        return;
+    }
+
+    if (!lockFile.lock()) {
+        qWarning() << "Failed to lock thumbnail pack" << file.fileName();
+        return;
+    }
+    const auto unlock = qScopeGuard([this] { lockFile.unlock(); });
+    if (fileInode(file.fileName()) != inode && (activeReaders > 0 || !reopen())) {
+        return;
+    }
+
+    // Nobody else appends while the lock file is held, so this is where the record goes
+    const qint64 offset = file.size();
+    if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)
+        || file.write(path) != path.size() || file.write(data) != data.size() || !file.flush()) {
+        qWarning() << "Failed to write thumbnail pack" << file.fileName() << file.errorString();
+        file.resize(offset);
+        return;
+    }
+
+    const QString key = indexKey(imagePath, thumbSize, layout);
+    const auto previous = index.constFind(key);
+    if (previous != index.constEnd()) {
+        liveBytes -= previous->length;
+    }
+    index.insert(key, {offset, recordLength, header.lastModified, header.fileSize});
+    liveBytes += recordLength;
+}
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QLockFile>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <memory>
+
+// Private thumbnail store holding all thumbnails of one directory in a single append-only file.
+// The file is memory mapped and indexed on open, so a lookup is a hash probe plus a JPEG decode
+// instead of an MD5, several stat() calls and a PNG decode per image.
+// Thumbnails are kept per size and layout, since the layout decides how the image is scaled
+// before it gets cropped. There is only ever one instance per pack file, shared between the
+// thumbnail worker threads, and all methods are thread safe. Other processes, like batch mode,
+// are kept out by a lock file while the pack is scanned, compacted or appended to.
+class ThumbnailPack {
+public:
+    static std::shared_ptr<ThumbnailPack> forDirectory(const QString &directoryPath);
+
+    explicit ThumbnailPack(const QString &packFilePath);
+
+    ~ThumbnailPack();
+
+    bool find(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+              int thumbSize, unsigned int layout, QImage *image);
+
+    void insert(const QString &imagePath, const QDateTime &lastModified, qint64 fileSize,
+                int thumbSize, unsigned int layout, const QImage &image);
+
+private:
+    struct IndexEntry
+    {
+        qint64 offset;
+        qint64 length;
+        qint64 lastModified;
+        qint64 fileSize;
+    };
+
+    struct MappedRegion
+    {
+        qint64 offset;
+        qint64 size;
+        uchar *data;
+    };
+
+    // Takes the lock file and opens the pack
+    bool open();
+
+    // Opens, scans and if need be compacts the pack, with the lock file held
+    bool openLocked();
+
+    // Opens the file another process compacted the pack into, with the lock file held and no
+    // reader left
+    bool reopen();
+
+    // Indexes the records, called with the lock file held
+    void scan();
+
+    bool compact();
+
+    const uchar *mapRecord(qint64 offset, qint64 length);
+
+    // Unmaps the regions, or leaves that to the last reader still decoding from them
+    void retireRegions();
+
+    void releaseReader();
+
+    void unmapAll();
+
+    static QString indexKey(const QString &imagePath, int thumbSize, unsigned int layout);
+
+    QMutex mutex;
+    QFile file;
+    QLockFile lockFile;
+    // Of the file when it was opened, a different one means another process compacted the pack
+    quint64 inode = 0;
+    QHash<QString, IndexEntry> index;
+    // Decoding happens without the mutex, so regions are only unmapped once no reader is left
+    QVector<MappedRegion> mappedRegions;
+    QVector<MappedRegion> retiredRegions;
+    int activeReaders = 0;
+    QWaitCondition readersDone;
+    qint64 mappedEnd = 0;
+    qint64 liveBytes = 0;
+    bool isOpen = false;
+};
@@ -0,0 +1,145 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailWriter.h"
+#include "PipelineStats.h"
+
+#include <QColorSpace>
+#include <QDebug>
+#include <QHash>
+#include <QMutex>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+namespace ThumbnailWriter {
+
+// Thumbnails beyond this are dropped unless blocking, they just get generated again next time
+static const int maxPendingWrites = 256;
+
+struct PendingWrite
+{
+    QImage thumbnail;
+    int maxSize = 0;
+    QMap<QString, QString> texts;
+};
+
+static QMutex mutex;
+static QWaitCondition writeTaken;
+static QHash<QString, PendingWrite> pendingWrites;
+static QStringList writeOrder;
+static bool isWriting = false;
+static bool isBlocking = false;
+static int failedWriteCount = 0;
+
+// A single thread drains the queue, set up once with the pool
+class WriterPool : public QThreadPool {
+public:
+    WriterPool() { setMaxThreadCount(1); }
+};
+
+static QThreadPool &writerPool()
+{
+    static WriterPool pool;
+    return pool;
+}
+
+static void writeThumbnail(const QString &fullPath, const PendingWrite &pendingWrite)
+{
+    PipelineStats::ScopedTimer timer(PipelineStats::StoreThumbnail);
+    QImage thumbnail = pendingWrite.thumbnail.scaled(pendingWrite.maxSize, pendingWrite.maxSize,
+                                                     Qt::KeepAspectRatio);
+    for (auto it = pendingWrite.texts.constBegin(); it != pendingWrite.texts.constEnd(); ++it) {
+        thumbnail.setText(it.key(), it.value());
+    }
+    thumbnail.convertToColorSpace(QColorSpace::SRgb);
+
+    QSaveFile file(fullPath);
+    if (!file.open(QIODevice::WriteOnly) || !thumbnail.save(&file, "PNG") || !file.commit()) {
+        qWarning() << "Failed to store thumbnail" << fullPath << file.errorString();
+        QMutexLocker locker(&mutex);
+        ++failedWriteCount;
+    }
+}
+
+class Writer : public QRunnable {
+public:
+    void run() override
+    {
+        forever {
+            QString fullPath;
+            PendingWrite pendingWrite;
+            {
+                QMutexLocker locker(&mutex);
+                if (writeOrder.isEmpty()) {
+                    isWriting = false;
+                    return;
+                }
+                fullPath = writeOrder.takeFirst();
+                pendingWrite = pendingWrites.take(fullPath);
+                writeTaken.wakeAll();
+            }
+
+            writeThumbnail(fullPath, pendingWrite);
+        }
+    }
+};
+
+void setBlocking(bool blocking)
+{
+    QMutexLocker locker(&mutex);
+    isBlocking = blocking;
+}
+
+void enqueue(const QString &fullPath, const QImage &thumbnail, int maxSize,
+             const QMap<QString, QString> &texts)
+{
+    QMutexLocker locker(&mutex);
+    if (!pendingWrites.contains(fullPath)) {
+        // The writer is running whenever the queue is not empty, so there will be room
+        while (isBlocking && writeOrder.size() >= maxPendingWrites) {
+            writeTaken.wait(&mutex);
+        }
+        if (writeOrder.size() >= maxPendingWrites) {
+            qWarning() << "Thumbnail write queue full, not storing" << fullPath;
+            ++failedWriteCount;
+            return;
+        }
+        writeOrder.append(fullPath);
+    }
+    // A newer thumbnail for the same file replaces the one still waiting
+    pendingWrites.insert(fullPath, {thumbnail, maxSize, texts});
+
+    if (!isWriting) {
+        isWriting = true;
+        writerPool().start(new Writer);
+    }
+}
+
+void waitForDone()
+{
+    writerPool().waitForDone();
+}
+
+int failedWrites()
+{
+    QMutexLocker locker(&mutex);
+    return failedWriteCount;
+}
+}
@@ -0,0 +1,41 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QMap>
+
+// Writes generated thumbnails to the freedesktop thumbnail store on a background thread, so
+// the rescale and the PNG compression do not hold up decoding. Writes are bounded, writes to
+// the same file are coalesced and every file is replaced atomically.
+namespace ThumbnailWriter {
+
+// By default a full queue drops the thumbnail, so the viewer never waits for the disk. Batch
+// mode, which only generates thumbnails to store them, makes enqueue() wait for room instead.
+void setBlocking(bool blocking);
+
+// The thumbnail is scaled down to maxSize and gets the given text chunks before it is saved
+void enqueue(const QString &fullPath, const QImage &thumbnail, int maxSize,
+             const QMap<QString, QString> &texts);
+
+// Blocks until everything queued so far has been written
+void waitForDone();
+
+// The thumbnails dropped from a full queue or which failed to save since the start
+int failedWrites();
+}
@@ -0,0 +1,404 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbsModel.h"
+#include "ThumbsViewer.h"
+
+#include <QIcon>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+
+ThumbsModel::ThumbsModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , sortRoleValue(ThumbsViewer::SortRole)
+{
+}
+
+int ThumbsModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : fileNames.size();
+}
+
+QVariant ThumbsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= fileNames.size()) {
+        return QVariant();
+    }
+
+    const int row = index.row();
+    switch (role) {
+    case Qt::DisplayRole:
+        return showFileNames ? QVariant(fileNames[row]) : QVariant();
+    case Qt::DecorationRole:
+        // As an icon, so the delegate fits it into the icon size of the view
+        return pixmaps[row].isNull() ? QVariant() : QVariant(QIcon(pixmaps[row]));
+    case Qt::TextAlignmentRole:
+        return showFileNames ? QVariant(int(Qt::AlignTop | Qt::AlignHCenter)) : QVariant();
+    case Qt::SizeHintRole:
+        return itemSizeHint;
+    case ThumbsViewer::FileNameRole:
+        return filePath(row);
+    case ThumbsViewer::SortRole:
+        return sortKeys[row];
+    case ThumbsViewer::LoadedRole:
+        return bool(loaded[row]);
+    case ThumbsViewer::BrightnessRole:
+        return std::isnan(brightnesses[row]) ? QVariant() : QVariant(qreal(brightnesses[row]));
+    case ThumbsViewer::TypeRole:
+        return QFileInfo(fileNames[row]).suffix();
+    case ThumbsViewer::SizeRole:
+        return fileSizes[row];
+    case ThumbsViewer::TimeRole:
+        return lastModified(row);
+    default:
+        return QVariant();
+    }
+}
+
+bool ThumbsModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (!index.isValid() || index.row() >= fileNames.size()) {
+        return false;
+    }
+
+    const int row = index.row();
+    switch (role) {
+    case Qt::DecorationRole:
+        pixmaps[row] = value.value<QPixmap>();
+        break;
+    case ThumbsViewer::SortRole:
+        sortKeys[row] = value.toInt();
+        break;
+    case ThumbsViewer::LoadedRole:
+        loaded[row] = value.toBool();
+        break;
+    case ThumbsViewer::BrightnessRole:
+        brightnesses[row] =
+            value.isValid() ? value.toFloat() : std::numeric_limits<float>::quiet_NaN();
+        break;
+    default:
+        return false;
+    }
+
+    emit dataChanged(index, index, {role});
+    return true;
+}
+
+Qt::ItemFlags ThumbsModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid()) {
+        return Qt::NoItemFlags;
+    }
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsDragEnabled
+        | Qt::ItemNeverHasChildren;
+}
+
+bool ThumbsModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    if (parent.isValid() || row < 0 || count <= 0 || row + count > fileNames.size()) {
+        return false;
+    }
+
+    beginRemoveRows(parent, row, row + count - 1);
+    directoryIndices.remove(row, count);
+    fileNames.remove(row, count);
+    fileSizes.remove(row, count);
+    modificationTimes.remove(row, count);
+    sortKeys.remove(row, count);
+    brightnesses.remove(row, count);
+    histograms.remove(row, count);
+    loaded.remove(row, count);
+    pixmaps.remove(row, count);
+    endRemoveRows();
+    return true;
+}
+
+template <typename T> void ThumbsModel::permute(QVector<T> &values, const QVector<int> &order)
+{
+    QVector<T> permuted;
+    permuted.reserve(values.size());
+    for (const int row : order) {
+        permuted.append(std::move(values[row]));
+    }
+    values.swap(permuted);
+}
+
+void ThumbsModel::sort(int column, Qt::SortOrder order)
+{
+    if (column != 0 || fileNames.size() < 2) {
+        return;
+    }
+
+    std::function<bool(int, int)> lessThan;
+    switch (sortRoleValue) {
+    case ThumbsViewer::FileNameRole:
+        lessThan = [this](int a, int b) { return filePath(a) < filePath(b); };
+        break;
+    case ThumbsViewer::SizeRole:
+        lessThan = [this](int a, int b) { return fileSizes[a] < fileSizes[b]; };
+        break;
+    case ThumbsViewer::TimeRole:
+        lessThan = [this](int a, int b) { return modificationTimes[a] < modificationTimes[b]; };
+        break;
+    case ThumbsViewer::TypeRole:
+        lessThan = [this](int a, int b) {
+            return QFileInfo(fileNames[a]).suffix() < QFileInfo(fileNames[b]).suffix();
+        };
+        break;
+    case ThumbsViewer::BrightnessRole:
+        // Only compares known brightnesses, the NaNs are moved out of the way first
+        lessThan = [this](int a, int b) { return brightnesses[a] < brightnesses[b]; };
+        break;
+    default:
+        lessThan = [this](int a, int b) { return sortKeys[a] < sortKeys[b]; };
+        break;
+    }
+
+    QVector<int> newOrder(fileNames.size());
+    std::iota(newOrder.begin(), newOrder.end(), 0);
+    auto sortedEnd = newOrder.end();
+    if (sortRoleValue == ThumbsViewer::BrightnessRole) {
+        // NaN until the thumbnail is loaded, which breaks the ordering of a comparison. Those
+        // rows stay last in both directions.
+        sortedEnd = std::stable_partition(newOrder.begin(), newOrder.end(), [this](int row) {
+            return !std::isnan(brightnesses[row]);
+        });
+    }
+    if (order == Qt::AscendingOrder) {
+        std::stable_sort(newOrder.begin(), sortedEnd, lessThan);
+    } else {
+        std::stable_sort(newOrder.begin(), sortedEnd,
+                         [&lessThan](int a, int b) { return lessThan(b, a); });
+    }
+
+    applyOrder(newOrder);
+}
+
+void ThumbsModel::sortRows(int firstRow, const QVector<int> &sortKeys)
+{
+    if (firstRow < 0 || firstRow + sortKeys.size() != fileNames.size()) {
+        return;
+    }
+
+    std::copy(sortKeys.cbegin(), sortKeys.cend(), this->sortKeys.begin() + firstRow);
+
+    QVector<int> newOrder(fileNames.size());
+    std::iota(newOrder.begin(), newOrder.end(), 0);
+    std::stable_sort(newOrder.begin() + firstRow, newOrder.end(),
+                     [this](int a, int b) { return this->sortKeys[a] < this->sortKeys[b]; });
+    applyOrder(newOrder);
+}
+
+void ThumbsModel::applyOrder(const QVector<int> &newOrder)
+{
+    emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+    permute(directoryIndices, newOrder);
+    permute(fileNames, newOrder);
+    permute(fileSizes, newOrder);
+    permute(modificationTimes, newOrder);
+    permute(sortKeys, newOrder);
+    permute(brightnesses, newOrder);
+    permute(histograms, newOrder);
+    permute(loaded, newOrder);
+    permute(pixmaps, newOrder);
+
+    QVector<int> newRows(newOrder.size());
+    for (int row = 0; row < newOrder.size(); ++row) {
+        newRows[newOrder[row]] = row;
+    }
+
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    for (const QModelIndex &oldIndex : oldIndexes) {
+        newIndexes.append(index(newRows[oldIndex.row()], 0));
+    }
+    changePersistentIndexList(oldIndexes, newIndexes);
+
+    emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+}
+
+void ThumbsModel::setSortRole(int role)
+{
+    sortRoleValue = role;
+}
+
+int ThumbsModel::sortRole() const
+{
+    return sortRoleValue;
+}
+
+void ThumbsModel::setItemSizeHint(const QSize &sizeHint)
+{
+    itemSizeHint = sizeHint;
+    if (!fileNames.isEmpty()) {
+        emit dataChanged(index(0, 0), index(fileNames.size() - 1, 0), {Qt::SizeHintRole});
+    }
+}
+
+void ThumbsModel::setShowFileNames(bool showFileNames)
+{
+    this->showFileNames = showFileNames;
+}
+
+void ThumbsModel::clear()
+{
+    beginResetModel();
+    directories.clear();
+    directoryIds.clear();
+    directoryIndices.clear();
+    fileNames.clear();
+    fileSizes.clear();
+    modificationTimes.clear();
+    sortKeys.clear();
+    brightnesses.clear();
+    histograms.clear();
+    loaded.clear();
+    pixmaps.clear();
+    endResetModel();
+}
+
+int ThumbsModel::directoryIndex(const QString &directory)
+{
+    auto directoryId = directoryIds.constFind(directory);
+    if (directoryId == directoryIds.constEnd()) {
+        directoryId = directoryIds.insert(directory, directories.size());
+        directories.append(directory);
+    }
+    return *directoryId;
+}
+
+void ThumbsModel::appendThumbs(const QFileInfoList &fileInfos, const QVector<int> &sortKeys)
+{
+    if (fileInfos.isEmpty()) {
+        return;
+    }
+
+    const int first = fileNames.size();
+    beginInsertRows(QModelIndex(), first, first + fileInfos.size() - 1);
+    for (int i = 0; i < fileInfos.size(); ++i) {
+        const QFileInfo &fileInfo = fileInfos.at(i);
+
+        // Everything in front of the file name, separator included, so paths come back unchanged
+        const QString filePath = fileInfo.filePath();
+        const QString fileName = fileInfo.fileName();
+        const QString directory = filePath.left(filePath.size() - fileName.size());
+        directoryIndices.append(directoryIndex(directory));
+        fileNames.append(fileName);
+        fileSizes.append(fileInfo.size());
+        modificationTimes.append(fileInfo.lastModified().toMSecsSinceEpoch());
+        this->sortKeys.append(sortKeys.at(i));
+        brightnesses.append(std::numeric_limits<float>::quiet_NaN());
+        histograms.append(nullptr);
+        loaded.append(false);
+        pixmaps.append(QPixmap());
+    }
+    endInsertRows();
+}
+
+int ThumbsModel::appendThumb(const QFileInfo &fileInfo, int sortKey)
+{
+    appendThumbs({fileInfo}, {sortKey});
+    return fileNames.size() - 1;
+}
+
+QString ThumbsModel::filePath(int row) const
+{
+    return directories.at(directoryIndices.at(row)) + fileNames.at(row);
+}
+
+void ThumbsModel::setFilePath(int row, const QString &filePath)
+{
+    const QString fileName = QFileInfo(filePath).fileName();
+    const QString directory = filePath.left(filePath.size() - fileName.size());
+    directoryIndices[row] = directoryIndex(directory);
+    fileNames[row] = fileName;
+
+    const QModelIndex thumbIndex = index(row, 0);
+    emit dataChanged(thumbIndex, thumbIndex);
+}
+
+void ThumbsModel::updateFile(int row, const QFileInfo &fileInfo)
+{
+    fileSizes[row] = fileInfo.size();
+    modificationTimes[row] = fileInfo.lastModified().toMSecsSinceEpoch();
+    brightnesses[row] = std::numeric_limits<float>::quiet_NaN();
+    histograms[row] = nullptr;
+    loaded[row] = false;
+    pixmaps[row] = QPixmap();
+
+    const QModelIndex thumbIndex = index(row, 0);
+    emit dataChanged(thumbIndex, thumbIndex);
+}
+
+QString ThumbsModel::fileName(int row) const
+{
+    return fileNames.at(row);
+}
+
+QDateTime ThumbsModel::lastModified(int row) const
+{
+    return QDateTime::fromMSecsSinceEpoch(modificationTimes.at(row));
+}
+
+qint64 ThumbsModel::fileSize(int row) const
+{
+    return fileSizes.at(row);
+}
+
+bool ThumbsModel::isLoaded(int row) const
+{
+    return loaded.at(row);
+}
+
+void ThumbsModel::setLoaded(int row, bool value)
+{
+    setData(index(row, 0), value, ThumbsViewer::LoadedRole);
+}
+
+QPixmap ThumbsModel::pixmap(int row) const
+{
+    return pixmaps.at(row);
+}
+
+void ThumbsModel::setThumb(int row, const QPixmap &pixmap, qreal brightness,
+                           const std::shared_ptr<const Histogram> &histogram)
+{
+    pixmaps[row] = pixmap;
+    brightnesses[row] = float(brightness);
+    histograms[row] = histogram;
+    loaded[row] = true;
+
+    const QModelIndex thumbIndex = index(row, 0);
+    emit dataChanged(thumbIndex, thumbIndex,
+                     {Qt::DecorationRole, ThumbsViewer::BrightnessRole, ThumbsViewer::LoadedRole});
+}
+
+std::shared_ptr<const Histogram> ThumbsModel::histogram(int row) const
+{
+    return histograms.at(row);
+}
+
+void ThumbsModel::setHistogram(int row, const std::shared_ptr<const Histogram> &histogram)
+{
+    histograms[row] = histogram;
+}
@@ -0,0 +1,134 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+#include <QPixmap>
+#include <QSize>
+#include <QVector>
+
+#include <memory>
+
+// List model behind ThumbsViewer. Every file is kept as one entry in a set of parallel arrays
+// and the item roles are put together in data() when the view asks for them. Directories are
+// stored once and referenced by index. Thumbnail pixmaps are implicitly shared with the
+// ThumbnailCache entries they came from.
+//
+// Without its thumbnail an item costs about 120 bytes plus twice the length of its file name,
+// counted from the sizes of the arrays' elements and of the file name's string data on a 64 bit
+// build: 85 bytes in the arrays, about 34 for the file name's allocation.
+class ThumbsModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    explicit ThumbsModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    // Sorts the rows from firstRow on by the given keys, which replace their sort keys. The rows
+    // before firstRow stay where they are.
+    void sortRows(int firstRow, const QVector<int> &sortKeys);
+
+    void setSortRole(int role);
+
+    [[nodiscard]] int sortRole() const;
+
+    // Shared by all items, like the thumbnail size and layout they depend on
+    void setItemSizeHint(const QSize &sizeHint);
+
+    void setShowFileNames(bool showFileNames);
+
+    void clear();
+
+    // Appends the files in one go, which is a lot cheaper for the view than one row at a time
+    void appendThumbs(const QFileInfoList &fileInfos, const QVector<int> &sortKeys);
+
+    int appendThumb(const QFileInfo &fileInfo, int sortKey);
+
+    [[nodiscard]] QString filePath(int row) const;
+
+    // Renames the item, the file itself has to be renamed by the caller
+    void setFilePath(int row, const QString &filePath);
+
+    // Takes the new size and time of a file changed on disk and drops its thumbnail
+    void updateFile(int row, const QFileInfo &fileInfo);
+
+    [[nodiscard]] QString fileName(int row) const;
+
+    [[nodiscard]] QDateTime lastModified(int row) const;
+
+    [[nodiscard]] qint64 fileSize(int row) const;
+
+    [[nodiscard]] bool isLoaded(int row) const;
+
+    void setLoaded(int row, bool value);
+
+    [[nodiscard]] QPixmap pixmap(int row) const;
+
+    // Sets the thumbnail, its brightness (NaN if unknown) and histogram (null if unknown) and
+    // marks the item as loaded
+    void setThumb(int row, const QPixmap &pixmap, qreal brightness,
+                  const std::shared_ptr<const Histogram> &histogram);
+
+    [[nodiscard]] std::shared_ptr<const Histogram> histogram(int row) const;
+
+    void setHistogram(int row, const std::shared_ptr<const Histogram> &histogram);
+
+private:
+    int directoryIndex(const QString &directory);
+
+    template <typename T> static void permute(QVector<T> &values, const QVector<int> &order);
+
+    // Moves row newOrder[row] to row, for all rows
+    void applyOrder(const QVector<int> &newOrder);
+
+    int sortRoleValue;
+    QSize itemSizeHint;
+    bool showFileNames = true;
+
+    QStringList directories;
+    QHash<QString, int> directoryIds;
+
+    QVector<int> directoryIndices;
+    QVector<QString> fileNames;
+    QVector<qint64> fileSizes;
+    // Milliseconds since the epoch
+    QVector<qint64> modificationTimes;
+    QVector<int> sortKeys;
+    // NaN until the thumbnail has been loaded
+    QVector<float> brightnesses;
+    // Shared with the ThumbnailCache entries, like the pixmaps
+    QVector<std::shared_ptr<const Histogram>> histograms;
+    QVector<bool> loaded;
+    QVector<QPixmap> pixmaps;
+};
@@ -17,34 +17,108 @@
  */
 
 #include "ThumbsViewer.h"
+#include "DirectoryWalker.h"
+#include "DuplicateFinder.h"
+#include "ImageFeatureStore.h"
+#include "ImageHash.h"
 #include "ImagePreview.h"
 #include "ImageViewer.h"
 #include "InfoViewer.h"
+#include "Parallel.h"
 #include "Phototonic.h"
+#include "PipelineStats.h"
 #include "Settings.h"
+#include "SimilarityOrder.h"
 #include "SmartCrop.h"
 #include "Tags.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailLoader.h"
+#include "Trace.h"
 
 #include <QApplication>
-#include <QBitArray>
 #include <QCollator>
-#include <QColorSpace>
-#include <QCryptographicHash>
 #include <QDirIterator>
 #include <QDrag>
 #include <QElapsedTimer>
 #include <QImageReader>
 #include <QMimeData>
-#include <QMimeDatabase>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QProgressDialog>
 #include <QRandomGenerator>
 #include <QScrollBar>
-#include <QStandardPaths>
+
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <vector>
 
 #define BATCH_SIZE 10
 
+namespace { // anonymous, not visible outside of this file
+// Returns the order of the files for the sort flags, with the direction of the thumbnail view:
+// ascending unless QDir::Reversed is set. Ties are broken by a natural sort on the file name.
+// The collation keys are built once per file, in parallel, so the sort itself only compares
+// bytes instead of running a full collation for every comparison.
+std::vector<int> sortedOrder(const QFileInfoList &fileInfos, QDir::SortFlags sortFlags)
+{
+    const int count = fileInfos.size();
+    const Qt::CaseSensitivity caseSensitivity
+        = sortFlags & QDir::IgnoreCase ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    std::vector<std::optional<QCollatorSortKey>> sortKeys(count);
+    std::vector<QString> fileNames(count);
+    std::vector<qint64> values(sortFlags & (QDir::Time | QDir::Size) ? count : 0);
+    std::vector<QString> suffixes(sortFlags & QDir::Type ? count : 0);
+
+    // QFileInfo caches lazily and must not be shared between threads, so everything the sort
+    // needs is copied out of it on this thread first
+    for (int i = 0; i < count; ++i) {
+        const QFileInfo &fileInfo = fileInfos.at(i);
+        fileNames[i] = fileInfo.fileName();
+        if (sortFlags & QDir::Time) {
+            values[i] = fileInfo.lastModified().toMSecsSinceEpoch();
+        } else if (sortFlags & QDir::Size) {
+            values[i] = fileInfo.size();
+        } else if (sortFlags & QDir::Type) {
+            suffixes[i] = fileInfo.suffix();
+        }
+    }
+
+    Parallel::forChunks(count, 1024, [&](int begin, int end) {
+        // QCollator sets itself up lazily and is not safe to share between threads
+        QCollator collator;
+        collator.setNumericMode(true);
+        collator.setCaseSensitivity(caseSensitivity);
+
+        for (int i = begin; i < end; ++i) {
+            sortKeys[i].emplace(collator.sortKey(fileNames[i]));
+        }
+    });
+
+    const bool reversed = sortFlags & QDir::Reversed;
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    Parallel::sort(order.begin(), order.end(), [&](int a, int b) {
+        int result = 0;
+        if (!values.empty()) {
+            result = values[a] < values[b] ? -1 : values[a] > values[b];
+        } else if (!suffixes.empty()) {
+            result = QString::compare(suffixes[a], suffixes[b], caseSensitivity);
+        }
+        if (result == 0) {
+            result = sortKeys[a]->compare(*sortKeys[b]);
+        }
+
+        if (result != 0) {
+            return reversed ? result > 0 : result < 0;
+        }
+        return a < b;
+    });
+
+    return order;
+}
+}
+
 ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache> &metadataCache)
     : QListView(parent)
 {
@@ -57,6 +131,21 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     Settings::thumbsPagesReadCount =
         Settings::appSettings->value(Settings::optionThumbsPagesReadCount).toUInt();
     thumbSize = Settings::appSettings->value(Settings::optionThumbsZoomLevel).toInt();
+    Settings::thumbsCacheSize =
+        Settings::appSettings->value(Settings::optionThumbsCacheSize, 256).toInt();
+    ThumbnailCache::setMaxSize(Settings::thumbsCacheSize);
+    Settings::thumbsPackedStore =
+        Settings::appSettings->value(Settings::optionThumbsPackedStore, false).toBool();
+    Settings::directoryScanThreads =
+        Settings::appSettings->value(Settings::optionDirectoryScanThreads, 4).toInt();
+    Settings::duplicateHashDistance =
+        Settings::appSettings->value(Settings::optionDuplicateHashDistance, 4).toInt();
+    Settings::exactDuplicatesOnly =
+        Settings::appSettings->value(Settings::optionExactDuplicatesOnly, false).toBool();
+    Settings::duplicateHashMethod =
+        Settings::appSettings
+            ->value(Settings::optionDuplicateHashMethod, ImageHash::DifferenceHash)
+            .toInt();
     currentRow = 0;
 
     setViewMode(QListView::IconMode);
@@ -72,7 +161,7 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     // QAbstractItemView::ScrollPerPixel instead.
     setVerticalScrollMode(QAbstractItemView::ScrollPerItem);
 
-    thumbsViewerModel = new QStandardItemModel(this);
+    thumbsViewerModel = new ThumbsModel(this);
     thumbsViewerModel->setSortRole(SortRole);
     setModel(thumbsViewerModel);
 
@@ -93,6 +182,23 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     phototonic = (Phototonic *)parent;
 
     connect(&m_loadThumbTimer, &QTimer::timeout, this, &ThumbsViewer::loadThumbsRange);
+
+    // Saving or copying a file fires a burst of notifications, handle them together
+    m_directoryChangeTimer.setInterval(300);
+    m_directoryChangeTimer.setSingleShot(true);
+    connect(&m_directoryChangeTimer, &QTimer::timeout, this,
+            &ThumbsViewer::applyDirectoryChanges);
+    connect(&directoryWatcher, &QFileSystemWatcher::directoryChanged, this,
+            [this](const QString &directory) {
+                changedDirectories.insert(directory);
+                m_directoryChangeTimer.start();
+            });
+    connect(metadataCache.get(), &MetadataCache::imageMetadataLoaded, this,
+            &ThumbsViewer::onImageMetadataLoaded);
+
+    thumbnailLoader = new ThumbnailLoader(this);
+    connect(thumbnailLoader, &ThumbnailLoader::thumbnailsReady, this,
+            &ThumbsViewer::onThumbnailsReady);
     connect(this, &ThumbsViewer::doubleClicked, phototonic, &Phototonic::loadSelectedThumbImage);
 
     infoView = new InfoView(this);
@@ -168,9 +274,7 @@ void ThumbsViewer::selectCurrentIndex()
 QString ThumbsViewer::getSingleSelectionFilename()
 {
     if (selectionModel()->selectedIndexes().size() == 1)
-        return thumbsViewerModel->item(selectionModel()->selectedIndexes().first().row())
-            ->data(FileNameRole)
-            .toString();
+        return thumbsViewerModel->filePath(selectionModel()->selectedIndexes().first().row());
 
     return QLatin1String("");
 }
@@ -215,7 +319,8 @@ void ThumbsViewer::setCurrentRow(int row)
 
 void ThumbsViewer::setImageViewerWindowTitle()
 {
-    QString title = thumbsViewerModel->item(currentRow)->data(Qt::DisplayRole).toString() + " - ["
+    QString title = thumbsViewerModel->data(thumbsViewerModel->index(currentRow, 0)).toString()
+        + " - ["
         + QString::number(currentRow + 1) + "/" + QString::number(thumbsViewerModel->rowCount())
         + "] - Phototonic";
 
@@ -237,7 +342,7 @@ bool ThumbsViewer::setCurrentIndexByName(const QString &fileName)
 
 bool ThumbsViewer::setCurrentIndexByRow(int row)
 {
-    QModelIndex idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(row));
+    QModelIndex idx = thumbsViewerModel->index(row, 0);
     if (idx.isValid()) {
         currentIndex = idx;
         setCurrentRow(idx.row());
@@ -249,7 +354,8 @@ bool ThumbsViewer::setCurrentIndexByRow(int row)
 
 void ThumbsViewer::updateImageInfoViewer(int row)
 {
-    QString imageFullPath = thumbsViewerModel->item(row)->data(FileNameRole).toString();
+    QString imageFullPath = thumbsViewerModel->filePath(row);
+    Trace::Scope trace("ThumbsViewer::updateImageInfoViewer", imageFullPath);
     QImageReader imageInfoReader(imageFullPath);
     QString key;
     QString val;
@@ -289,7 +395,9 @@ void ThumbsViewer::updateImageInfoViewer(int row)
         infoView->addEntry(key, val);
 
         key = tr("Average brightness");
-        val = QString::number(thumbsViewerModel->item(row)->data(BrightnessRole).toReal(), 'f', 2);
+        val = QString::number(
+            thumbsViewerModel->data(thumbsViewerModel->index(row, 0), BrightnessRole).toReal(), 'f',
+            2);
         infoView->addEntry(key, val);
     } else {
         imageInfoReader.read();
@@ -357,7 +465,7 @@ void ThumbsViewer::onSelectionChanged()
     int selectedThumbs = indexesList.size();
     if (selectedThumbs > 0) {
         int currentRow = indexesList.first().row();
-        QString thumbFullPath = thumbsViewerModel->item(currentRow)->data(FileNameRole).toString();
+        QString thumbFullPath = thumbsViewerModel->filePath(currentRow);
         setCurrentRow(currentRow);
 
         if (infoView->isVisible()) {
@@ -392,7 +500,7 @@ QStringList ThumbsViewer::getSelectedThumbsList()
 
     for (int tn = indexesList.size() - 1; tn >= 0; --tn) {
         SelectedThumbsPaths
-            << thumbsViewerModel->item(indexesList[tn].row())->data(FileNameRole).toString();
+            << thumbsViewerModel->filePath(indexesList[tn].row());
     }
 
     return SelectedThumbsPaths;
@@ -412,7 +520,7 @@ void ThumbsViewer::startDrag(Qt::DropActions)
                                          end = indexesList.constEnd();
          it != end; ++it) {
         urls << QUrl::fromLocalFile(
-            thumbsViewerModel->item(it->row())->data(FileNameRole).toString());
+            thumbsViewerModel->filePath(it->row()));
     }
     mimeData->setUrls(urls);
     drag->setMimeData(mimeData);
@@ -425,7 +533,7 @@ void ThumbsViewer::startDrag(Qt::DropActions)
         painter.setPen(QPen(Qt::white, 2));
         int x = 0, y = 0, xMax = 0, yMax = 0;
         for (int i = 0; i < qMin(5, indexesList.count()); ++i) {
-            QPixmap pix = thumbsViewerModel->item(indexesList.at(i).row())->icon().pixmap(72);
+            QPixmap pix = QIcon(thumbsViewerModel->pixmap(indexesList.at(i).row())).pixmap(72);
             if (i == 4) {
                 x = (xMax - pix.width()) / 2;
                 y = (yMax - pix.height()) / 2;
@@ -441,7 +549,7 @@ void ThumbsViewer::startDrag(Qt::DropActions)
         pix = pix.copy(0, 0, xMax, yMax);
         drag->setPixmap(pix);
     } else {
-        pix = thumbsViewerModel->item(indexesList.at(0).row())->icon().pixmap(128);
+        pix = QIcon(thumbsViewerModel->pixmap(indexesList.at(0).row())).pixmap(128);
         drag->setPixmap(pix);
     }
     drag->setHotSpot(QPoint(pix.width() / 2, pix.height() / 2));
@@ -451,6 +559,7 @@ void ThumbsViewer::startDrag(Qt::DropActions)
 void ThumbsViewer::abort(bool permanent)
 {
     isAbortThumbsLoading = true;
+    cancelPendingThumbs();
 
     if (!isClosing && permanent) {
         isClosing = true;
@@ -459,6 +568,8 @@ void ThumbsViewer::abort(bool permanent)
 
 void ThumbsViewer::loadVisibleThumbs(int scrollBarValue)
 {
+    // Outside of the recursion guard, so calls coming back through processEvents show up too
+    Trace::Scope trace("ThumbsViewer::loadVisibleThumbs");
 
     // Hack:
     // when a paint even is requested Qt first calls updateGeometry() on
@@ -483,13 +594,16 @@ void ThumbsViewer::loadVisibleThumbs(int scrollBarValue)
     }
 
     for (;;) {
-        int firstVisible = getFirstVisibleThumb();
-        int lastVisible = getLastVisibleThumb();
+        int firstVisible = firstVisibleRow(this);
+        int lastVisible = lastVisibleRow(this);
         if (isAbortThumbsLoading || firstVisible < 0 || lastVisible < 0) {
             processing = false;
             return;
         }
 
+        firstVisibleThumb = firstVisible;
+        lastVisibleThumb = lastVisible;
+
         if (scrolledForward) {
             lastVisible += ((lastVisible - firstVisible) * (Settings::thumbsPagesReadCount + 1));
             if (lastVisible >= thumbsViewerModel->rowCount()) {
@@ -524,34 +638,53 @@ void ThumbsViewer::loadVisibleThumbs(int scrollBarValue)
     processing = false;
 }
 
-int ThumbsViewer::getFirstVisibleThumb()
+int ThumbsViewer::thumbBottom(const QListView *view, int row)
 {
-    QModelIndex idx;
+    const QRect rect = view->visualRect(view->model()->index(row, 0));
+    return rect.y() + rect.height() + 1;
+}
 
-    for (int currThumb = 0; currThumb < thumbsViewerModel->rowCount(); ++currThumb) {
-        idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(currThumb));
-        if (viewport()->rect().contains(
-                QPoint(0, visualRect(idx).y() + visualRect(idx).height() + 1))) {
-            return idx.row();
+// The thumbs are laid out line by line in model order, so their bottom edges only grow with the
+// row and the visible range can be found by bisection instead of walking the whole model
+int ThumbsViewer::firstVisibleRow(const QListView *view)
+{
+    const int rowCount = view->model()->rowCount();
+    const QRect viewportRect = view->viewport()->rect();
+    int first = 0;
+    int last = rowCount;
+    while (first < last) {
+        const int middle = first + (last - first) / 2;
+        if (thumbBottom(view, middle) < viewportRect.top()) {
+            first = middle + 1;
+        } else {
+            last = middle;
         }
     }
 
-    return -1;
+    if (first >= rowCount || thumbBottom(view, first) > viewportRect.bottom()) {
+        return -1;
+    }
+    return first;
 }
 
-int ThumbsViewer::getLastVisibleThumb()
+int ThumbsViewer::lastVisibleRow(const QListView *view)
 {
-    QModelIndex idx;
-
-    for (int currThumb = thumbsViewerModel->rowCount() - 1; currThumb >= 0; --currThumb) {
-        idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(currThumb));
-        if (viewport()->rect().contains(
-                QPoint(0, visualRect(idx).y() + visualRect(idx).height() + 1))) {
-            return idx.row();
+    const QRect viewportRect = view->viewport()->rect();
+    int first = 0;
+    int last = view->model()->rowCount();
+    while (first < last) {
+        const int middle = first + (last - first) / 2;
+        if (thumbBottom(view, middle) <= viewportRect.bottom()) {
+            first = middle + 1;
+        } else {
+            last = middle;
         }
     }
 
-    return -1;
+    if (first == 0 || thumbBottom(view, first - 1) < viewportRect.top()) {
+        return -1;
+    }
+    return first - 1;
 }
 
 void ThumbsViewer::loadFileList()
@@ -587,11 +720,16 @@ void ThumbsViewer::reLoad()
 
     applyFilter();
     initThumbs();
-    updateThumbsCount();
-    loadVisibleThumbs();
-
-    if (Settings::includeSubDirectories) {
-        loadSubDirectories();
+    // An aborted listing is about to be replaced, the rest would only hold that up. With
+    // sub-directories it would even start a walk of the whole tree.
+    if (!isAbortThumbsLoading) {
+        watchDirectories({Settings::currentDirectory});
+        updateThumbsCount();
+        loadVisibleThumbs();
+
+        if (Settings::includeSubDirectories) {
+            loadSubDirectories();
+        }
     }
 
     phototonic->showBusyAnimation(false);
@@ -602,26 +740,27 @@ void ThumbsViewer::reLoad()
 
 void ThumbsViewer::loadSubDirectories()
 {
-    QDirIterator dirIterator(Settings::currentDirectory, QDirIterator::Subdirectories);
-
-    int processed = 0;
-    while (dirIterator.hasNext()) {
-        dirIterator.next();
-        if (dirIterator.fileInfo().isDir() && dirIterator.fileName() != QLatin1String(".")
-            && dirIterator.fileName() != QLatin1String("..")) {
-            thumbsDir.setPath(dirIterator.filePath());
-
-            initThumbs();
-            updateThumbsCount();
-            loadVisibleThumbs();
-
-            if (isAbortThumbsLoading) {
-                return;
-            }
+    DirectoryWalker directoryWalker(Settings::currentDirectory, thumbsDir.filter(),
+                                    thumbsDir.nameFilters(), Settings::directoryScanThreads);
+    directoryWalker.start();
+
+    QVector<DirectoryListing> listings;
+    while (directoryWalker.takeListings(&listings, 50)) {
+        QStringList directories;
+        for (const DirectoryListing &listing : qAsConst(listings)) {
+            appendSortedThumbs(listing.fileInfos);
+            directories.append(listing.path);
         }
-        if (++processed > BATCH_SIZE) {
+        watchDirectories(directories);
+        updateThumbsCount();
+        loadVisibleThumbs();
+
+        {
+            Trace::Scope trace("processEvents");
             QApplication::processEvents();
-            processed = 0;
+        }
+        if (isAbortThumbsLoading) {
+            return;
         }
     }
 
@@ -634,17 +773,7 @@ void ThumbsViewer::applyFilter()
     QString textFilter(QStringLiteral("*"));
     textFilter += filterString;
 
-    // Get all patterns supported by QImageReader
-    static QStringList imageTypeGlobs;
-    // Not threadsafe, but whatever
-    if (imageTypeGlobs.isEmpty()) {
-        QMimeDatabase db;
-        const auto &localSupportedMimeTypes = QImageReader::supportedMimeTypes();
-        for (const QByteArray &type : localSupportedMimeTypes) {
-            imageTypeGlobs.append(db.mimeTypeForName(type).globPatterns());
-        }
-    }
-    for (const QString &glob : imageTypeGlobs) {
+    for (const QString &glob : FileNameFilter::imageNameFilters()) {
         fileFilters.append(textFilter + glob);
     }
 
@@ -685,8 +814,23 @@ QSize ThumbsViewer::itemSizeHint() const
 
 void ThumbsViewer::loadPrepare()
 {
+    // Results still in flight belong to the old model contents and get dropped on arrival
+    cancelPendingThumbs();
+    pendingThumbs.clear();
+    ++thumbsGeneration;
+
+    // Only reLoad() watches the directories it shows again
+    const QStringList watchedDirectories = directoryWatcher.directories();
+    if (!watchedDirectories.isEmpty()) {
+        directoryWatcher.removePaths(watchedDirectories);
+    }
+    changedDirectories.clear();
+    directoriesAwaitingTags.clear();
+    m_directoryChangeTimer.stop();
 
     thumbsViewerModel->clear();
+    thumbsViewerModel->setItemSizeHint(itemSizeHint());
+    thumbsViewerModel->setShowFileNames(Settings::thumbsLayout != Squares);
     setIconSize(QSize(thumbSize, thumbSize));
 
     if (Settings::thumbsLayout == Squares) {
@@ -713,6 +857,8 @@ void ThumbsViewer::loadPrepare()
 
     thumbsRangeFirst = -1;
     thumbsRangeLast = -1;
+    firstVisibleThumb = -1;
+    lastVisibleThumb = -1;
 
     imageTags->resetTagsState();
 }
@@ -725,111 +871,380 @@ void ThumbsViewer::loadDuplicates()
 
     phototonic->setStatus(tr("Searching duplicate images..."));
 
-    dupImageHashes.clear();
-    findDupes(true);
+    duplicateFinder.reset(ImageHash::Method(Settings::duplicateHashMethod),
+                          Settings::duplicateHashDistance);
+
+    // Identical files can be anywhere, they are only looked for once all files are known
+    QFileInfoList allFileInfos;
+    const auto findInFiles = [this, &allFileInfos](const QFileInfoList &fileInfos) {
+        if (Settings::exactDuplicatesOnly) {
+            allFileInfos.append(fileInfos);
+        } else {
+            findDupes(fileInfos);
+        }
+    };
+
+    findInFiles(thumbsDir.entryInfoList());
     thumbsViewerModel->setSortRole(SortRole);
 
     if (Settings::includeSubDirectories) {
-        int processed = 0;
-        QDirIterator iterator(Settings::currentDirectory, QDirIterator::Subdirectories);
-        while (iterator.hasNext()) {
-            iterator.next();
-            if (iterator.fileInfo().isDir() && iterator.fileName() != QLatin1String(".")
-                && iterator.fileName() != QLatin1String("..")) {
-                thumbsDir.setPath(iterator.filePath());
-
-                findDupes(false);
+        DirectoryWalker directoryWalker(Settings::currentDirectory, thumbsDir.filter(),
+                                        thumbsDir.nameFilters(), Settings::directoryScanThreads);
+        directoryWalker.start();
+
+        QVector<DirectoryListing> listings;
+        while (!isAbortThumbsLoading && directoryWalker.takeListings(&listings, 50)) {
+            for (const DirectoryListing &listing : qAsConst(listings)) {
+                findInFiles(listing.fileInfos);
                 if (isAbortThumbsLoading) {
-                    goto finish;
+                    break;
                 }
             }
-            if (++processed > BATCH_SIZE) {
-                QApplication::processEvents();
-                processed = 0;
-            }
+            QApplication::processEvents();
         }
     }
 
-finish:
+    if (Settings::exactDuplicatesOnly && !isAbortThumbsLoading) {
+        thumbFileInfoList = allFileInfos;
+        duplicateFinder.addIdenticalFiles(
+            allFileInfos, [this](int id) { addDuplicate(id); },
+            [this] { return updateDupesProgress(); });
+    }
+    updateFoundDupesState(duplicateFinder.duplicateCount(), duplicateFinder.scannedFiles(),
+                          duplicateFinder.originalCount());
+
     thumbsViewerModel->sort(0);
     isBusy = false;
     phototonic->showBusyAnimation(false);
-    return;
 }
 
 void ThumbsViewer::initThumbs()
 {
+    Trace::Scope trace("ThumbsViewer::initThumbs", thumbsDir.path());
     phototonic->showBusyAnimation(true);
-    thumbFileInfoList = thumbsDir.entryInfoList();
 
-    if (!(thumbsSortFlags & QDir::Time) && !(thumbsSortFlags & QDir::Size)
-        && !(thumbsSortFlags & QDir::Type)) {
-        QCollator collator;
-        if (thumbsSortFlags & QDir::IgnoreCase) {
-            collator.setCaseSensitivity(Qt::CaseInsensitive);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastBatchTime = 0;
+    int scanned = 0;
+    const int firstRow = thumbsViewerModel->rowCount();
+    const FileNameFilter fileNameFilter(thumbsDir.nameFilters());
+
+    // Rows are appended in directory order while the scan runs and sorted once it is done
+    QDirIterator dirIterator(thumbsDir.path(), thumbsDir.filter());
+    QFileInfoList fileInfos;
+    QFileInfoList batchFileInfos;
+    QVector<int> batchSortKeys;
+    QStringList batchFilePaths;
+
+    auto appendBatch = [&]() {
+        const bool isFirstBatch = thumbsViewerModel->rowCount() == firstRow;
+        thumbsViewerModel->appendThumbs(batchFileInfos, batchSortKeys);
+        metadataCache->loadImageMetadataLater(batchFilePaths);
+        if (isFirstBatch && !batchFileInfos.isEmpty()) {
+            PipelineStats::record(PipelineStats::ShowFirstRows, timer.nsecsElapsed());
         }
+        batchFileInfos.clear();
+        batchSortKeys.clear();
+        batchFilePaths.clear();
+        lastBatchTime = timer.elapsed();
+
+        // The scroll bar is not connected during the scan, the rows in view have to be queued
+        // here so their thumbnails arrive while the listing goes on
+        loadVisibleThumbs();
+    };
 
-        collator.setNumericMode(true);
+    // Only the directory reads count for the statistics, not the model updates in between
+    qint64 listingTime = 0;
+    while (dirIterator.hasNext()) {
+        const qint64 nextStart = timer.nsecsElapsed();
+        dirIterator.next();
+        listingTime += timer.nsecsElapsed() - nextStart;
+
+        if (fileNameFilter.matches(dirIterator.fileName())) {
+            const QFileInfo fileInfo = dirIterator.fileInfo();
+
+            // Filtering reads the tags right away, everything else only needs the QFileInfo
+            if (!imageTags->dirFilteringActive
+                || !imageTags->isImageFilteredOut(fileInfo.filePath())) {
+                batchSortKeys.append(fileInfos.size());
+                batchFileInfos.append(fileInfo);
+                batchFilePaths.append(fileInfo.filePath());
+                fileInfos.append(fileInfo);
+            }
+        }
 
-        if (thumbsSortFlags & QDir::Reversed) {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(),
-                      [&](const QFileInfo &a, const QFileInfo &b) {
-                          return collator.compare(a.fileName(), b.fileName()) > 0;
-                      });
-        } else {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(),
-                      [&](const QFileInfo &a, const QFileInfo &b) {
-                          return collator.compare(a.fileName(), b.fileName()) < 0;
-                      });
+        // The first rows go out as soon as there are a few, the rest in batches every 50ms
+        const bool isFirstBatch = thumbsViewerModel->rowCount() == firstRow;
+        if ((isFirstBatch && batchFileInfos.size() > BATCH_SIZE)
+            || (++scanned % 64 == 0 && timer.elapsed() - lastBatchTime >= 50)) {
+            appendBatch();
+            {
+                Trace::Scope trace("processEvents");
+                QApplication::processEvents();
+            }
+            if (isAbortThumbsLoading) {
+                thumbFileInfoList = fileInfos;
+                phototonic->showBusyAnimation(false);
+                return;
+            }
         }
     }
+    appendBatch();
+    PipelineStats::record(PipelineStats::ListDirectory, listingTime);
 
-    static QStandardItem *thumbItem;
-    static int fileIndex;
-    static QPixmap emptyPixMap;
-    static QSize hintSize;
-    int processed = 0;
+    const std::vector<int> order = sortedOrder(fileInfos, thumbsSortFlags);
+    QVector<int> sortKeys(fileInfos.size());
+    thumbFileInfoList.clear();
+    thumbFileInfoList.reserve(fileInfos.size());
+    for (int position = 0; position < int(order.size()); ++position) {
+        sortKeys[order[position]] = position;
+        thumbFileInfoList.append(fileInfos.at(order[position]));
+    }
+    thumbsViewerModel->sortRows(firstRow, sortKeys);
+    // Other files are in view now, under the same rows
+    thumbsRangeFirst = -1;
+    thumbsRangeLast = -1;
+
+    imageTags->populateTagsTree();
+
+    if (!thumbFileInfoList.empty() && selectionModel()->selectedIndexes().empty()) {
+        selectThumbByRow(0);
+    }
+    phototonic->showBusyAnimation(false);
+}
+
+void ThumbsViewer::appendSortedThumbs(const QFileInfoList &fileInfos)
+{
+    QFileInfoList shownFileInfos;
+    shownFileInfos.reserve(fileInfos.size());
+    for (const QFileInfo &fileInfo : fileInfos) {
+        if (!imageTags->dirFilteringActive
+            || !imageTags->isImageFilteredOut(fileInfo.filePath())) {
+            shownFileInfos.append(fileInfo);
+        }
+    }
+
+    const std::vector<int> order = sortedOrder(shownFileInfos, thumbsSortFlags);
+    QFileInfoList sortedFileInfos;
+    QVector<int> sortKeys;
+    QStringList filePaths;
+    sortedFileInfos.reserve(shownFileInfos.size());
+    sortKeys.reserve(shownFileInfos.size());
+    for (int position = 0; position < int(order.size()); ++position) {
+        sortedFileInfos.append(shownFileInfos.at(order[position]));
+        sortKeys.append(position);
+        filePaths.append(sortedFileInfos.last().filePath());
+    }
+
+    thumbsViewerModel->appendThumbs(sortedFileInfos, sortKeys);
+    metadataCache->loadImageMetadataLater(filePaths);
+    thumbFileInfoList.append(sortedFileInfos);
+}
+
+void ThumbsViewer::watchDirectories(const QStringList &directories)
+{
+    if (directories.isEmpty()) {
+        return;
+    }
 
-    emptyPixMap = emptyImg.scaled(thumbSize, thumbSize);
-    hintSize = itemSizeHint();
+    const QStringList failedDirectories = directoryWatcher.addPaths(directories);
+    if (!failedDirectories.isEmpty()) {
+        qWarning() << "Not watching" << failedDirectories.size()
+                   << "directories for changes, the system limit may have been reached";
+    }
+}
+
+void ThumbsViewer::applyDirectoryChanges()
+{
+    if (isBusy) {
+        m_directoryChangeTimer.start();
+        return;
+    }
 
-    for (fileIndex = 0; fileIndex < thumbFileInfoList.size(); ++fileIndex) {
-        thumbFileInfo = thumbFileInfoList.at(fileIndex);
+    const QSet<QString> directories = changedDirectories;
+    changedDirectories.clear();
+
+    const FileNameFilter fileNameFilter(thumbsDir.nameFilters());
+    const QStringList watchedDirectoryList = directoryWatcher.directories();
+    QSet<QString> watchedDirectories(watchedDirectoryList.cbegin(), watchedDirectoryList.cend());
+    for (const QString &directory : directories) {
+        updateDirectory(directory, fileNameFilter, &watchedDirectories);
+    }
+
+    updateThumbsCount();
+    loadVisibleThumbs();
+}
+
+void ThumbsViewer::updateDirectory(const QString &directory, const FileNameFilter &fileNameFilter,
+                                   QSet<QString> *watchedDirectories)
+{
+    QHash<QString, QFileInfo> fileInfos;
+    QStringList newDirectories;
+    QDirIterator dirIterator(directory, thumbsDir.filter() | QDir::Dirs | QDir::NoDotAndDotDot);
+    while (dirIterator.hasNext()) {
+        dirIterator.next();
+        const QFileInfo fileInfo = dirIterator.fileInfo();
+        if (fileInfo.isDir()) {
+            if (Settings::includeSubDirectories && !fileInfo.isSymLink()
+                && !watchedDirectories->contains(fileInfo.filePath())) {
+                newDirectories.append(fileInfo.filePath());
+            }
+        } else if (fileNameFilter.matches(fileInfo.fileName())) {
+            fileInfos.insert(fileInfo.fileName(), fileInfo);
+        }
+    }
+
+    // Rows of files which are gone are removed, rows of changed files get a new thumbnail
+    // and whatever is left in fileInfos afterwards is new
+    const QHash<QString, QFileInfo> directoryFileInfos = fileInfos;
+    const QString prefix =
+        directory.endsWith(QLatin1Char('/')) ? directory : directory + QLatin1Char('/');
+    for (int row = thumbsViewerModel->rowCount() - 1; row >= 0; --row) {
+        const QString filePath = thumbsViewerModel->filePath(row);
+        const QString fileName = thumbsViewerModel->fileName(row);
+        if (filePath.size() != prefix.size() + fileName.size() || !filePath.startsWith(prefix)) {
+            continue;
+        }
 
-        metadataCache->loadImageMetadata(thumbFileInfo.filePath());
-        if (imageTags->dirFilteringActive
-            && imageTags->isImageFilteredOut(thumbFileInfo.filePath())) {
+        const auto fileInfo = fileInfos.find(fileName);
+        if (fileInfo == fileInfos.end()) {
+            thumbsViewerModel->removeRow(row);
             continue;
         }
 
-        thumbItem = new QStandardItem();
-        thumbItem->setData(false, LoadedRole);
-        thumbItem->setData(fileIndex, SortRole);
-        thumbItem->setData(thumbFileInfo.size(), SizeRole);
-        thumbItem->setData(thumbFileInfo.suffix(), TypeRole);
-        thumbItem->setData(thumbFileInfo.lastModified(), TimeRole);
-        thumbItem->setData(thumbFileInfo.filePath(), FileNameRole);
-        thumbItem->setSizeHint(hintSize);
-
-        if (Settings::thumbsLayout != Squares) {
-            thumbItem->setTextAlignment(Qt::AlignTop | Qt::AlignHCenter);
-            thumbItem->setText(thumbFileInfo.fileName());
+        if (fileInfo->lastModified() != thumbsViewerModel->lastModified(row)
+            || fileInfo->size() != thumbsViewerModel->fileSize(row)) {
+            thumbsViewerModel->updateFile(row, *fileInfo);
+        }
+        fileInfos.erase(fileInfo);
+    }
+
+    QFileInfoList newFileInfos;
+    QStringList newFilePaths;
+    DirectoryAwaitingTags awaitingTags;
+    QStringList awaitingFilePaths;
+    for (const QFileInfo &fileInfo : qAsConst(fileInfos)) {
+        if (imageTags->dirFilteringActive) {
+            // Reading the tags right here would block the GUI thread for every new file
+            if (!metadataCache->isCached(fileInfo.filePath())) {
+                awaitingTags.fileNames.insert(fileInfo.fileName());
+                awaitingFilePaths.append(fileInfo.filePath());
+                continue;
+            }
+            if (imageTags->isImageFilteredOut(fileInfo.filePath())) {
+                continue;
+            }
         }
+        newFileInfos.append(fileInfo);
+        newFilePaths.append(fileInfo.filePath());
+    }
+    if (!newFileInfos.isEmpty()) {
+        thumbsViewerModel->appendThumbs(newFileInfos, QVector<int>(newFileInfos.size(), 0));
+        metadataCache->loadImageMetadataLater(newFilePaths);
+        thumbFileInfoList.append(newFileInfos);
+        sortDirectoryRows(prefix, directoryFileInfos);
+    }
 
-        thumbsViewerModel->appendRow(thumbItem);
+    // Replaces whatever was waiting before, files which are gone again are not waited for
+    if (awaitingTags.fileNames.isEmpty()) {
+        directoriesAwaitingTags.remove(prefix);
+    } else {
+        awaitingTags.fileInfos = directoryFileInfos;
+        directoriesAwaitingTags.insert(prefix, awaitingTags);
+        metadataCache->loadImageMetadataLater(awaitingFilePaths);
+    }
 
-        if (++processed > BATCH_SIZE) {
-            QApplication::processEvents();
-            processed = 0;
+    for (const QString &newDirectory : qAsConst(newDirectories)) {
+        watchDirectories({newDirectory});
+        watchedDirectories->insert(newDirectory);
+        updateDirectory(newDirectory, fileNameFilter, watchedDirectories);
+    }
+}
+
+void ThumbsViewer::onImageMetadataLoaded(const QStringList &imageFullPaths)
+{
+    if (directoriesAwaitingTags.isEmpty()) {
+        return;
+    }
+
+    // Rows are not added in the middle of other work, the directories get listed again later and
+    // then find the tags in the cache
+    if (isBusy) {
+        for (const QString &imageFullPath : imageFullPaths) {
+            const int nameStart = imageFullPath.lastIndexOf(QLatin1Char('/')) + 1;
+            if (directoriesAwaitingTags.contains(imageFullPath.left(nameStart))) {
+                changedDirectories.insert(QFileInfo(imageFullPath).path());
+            }
         }
+        m_directoryChangeTimer.start();
+        return;
     }
 
-    imageTags->populateTagsTree();
+    QHash<QString, QFileInfoList> shownFileInfos;
+    for (const QString &imageFullPath : imageFullPaths) {
+        const int nameStart = imageFullPath.lastIndexOf(QLatin1Char('/')) + 1;
+        const QString prefix = imageFullPath.left(nameStart);
+        const auto directory = directoriesAwaitingTags.find(prefix);
+        if (directory == directoriesAwaitingTags.end()
+            || !directory->fileNames.remove(imageFullPath.mid(nameStart))) {
+            continue;
+        }
 
-    if (!thumbFileInfoList.empty() && selectionModel()->selectedIndexes().empty()) {
-        selectThumbByRow(0);
+        if (!imageTags->dirFilteringActive || !imageTags->isImageFilteredOut(imageFullPath)) {
+            shownFileInfos[prefix].append(
+                directory->fileInfos.value(imageFullPath.mid(nameStart)));
+        }
+    }
+
+    for (auto it = shownFileInfos.constBegin(); it != shownFileInfos.constEnd(); ++it) {
+        thumbsViewerModel->appendThumbs(it.value(), QVector<int>(it.value().size(), 0));
+        thumbFileInfoList.append(it.value());
+        sortDirectoryRows(it.key(), directoriesAwaitingTags.value(it.key()).fileInfos);
+    }
+    for (auto it = directoriesAwaitingTags.begin(); it != directoriesAwaitingTags.end();) {
+        it = it->fileNames.isEmpty() ? directoriesAwaitingTags.erase(it) : std::next(it);
+    }
+
+    if (!shownFileInfos.isEmpty()) {
+        updateThumbsCount();
+        loadVisibleThumbs();
     }
-    phototonic->showBusyAnimation(false);
+}
+
+void ThumbsViewer::sortDirectoryRows(const QString &prefix,
+                                     const QHash<QString, QFileInfo> &fileInfos)
+{
+    const int rowCount = thumbsViewerModel->rowCount();
+    QVector<int> rows;
+    QFileInfoList rowFileInfos;
+    for (int row = 0; row < rowCount; ++row) {
+        const QString filePath = thumbsViewerModel->filePath(row);
+        const QString fileName = thumbsViewerModel->fileName(row);
+        if (filePath.size() == prefix.size() + fileName.size() && filePath.startsWith(prefix)) {
+            rows.append(row);
+            rowFileInfos.append(fileInfos.value(fileName, QFileInfo(filePath)));
+        }
+    }
+    if (rows.isEmpty()) {
+        return;
+    }
+
+    // The files of the directory take the place of its first row, everything else keeps its order
+    const int firstRow = rows.first();
+    QVector<int> sortKeys(rowCount - firstRow);
+    int position = 0;
+    for (int index : sortedOrder(rowFileInfos, thumbsSortFlags)) {
+        sortKeys[rows.at(index) - firstRow] = position++;
+    }
+    for (int row = firstRow, index = 0; row < rowCount; ++row) {
+        if (index < rows.size() && rows.at(index) == row) {
+            ++index;
+        } else {
+            sortKeys[row - firstRow] = position++;
+        }
+    }
+    thumbsViewerModel->sortRows(firstRow, sortKeys);
 }
 
 void ThumbsViewer::updateThumbsCount()
@@ -862,79 +1277,37 @@ void ThumbsViewer::updateFoundDupesState(int duplicates, int filesScanned, int o
     phototonic->setStatus(state);
 }
 
-void ThumbsViewer::findDupes(bool resetCounters)
+void ThumbsViewer::addDuplicate(int id)
 {
-    thumbFileInfoList = thumbsDir.entryInfoList();
-    static int originalImages;
-    static int foundDups;
-    static int totalFiles;
-    if (resetCounters) {
-        originalImages = totalFiles = foundDups = 0;
-    }
-
-    int processed = 0;
-    for (int currThumb = 0; currThumb < thumbFileInfoList.size(); ++currThumb) {
-        if (++processed > BATCH_SIZE) {
-            thumbsViewerModel->sort(0);
-            QApplication::processEvents();
-            processed = 0;
-        }
-
-        thumbFileInfo = thumbFileInfoList.at(currThumb);
-        QImage image = QImage(thumbFileInfo.absoluteFilePath());
-        if (image.isNull()) {
-            qWarning() << "invalid image" << thumbFileInfo.fileName();
-            continue;
-        }
-
-        QBitArray imageHash(64);
-        image = image.convertToFormat(QImage::Format_Grayscale8)
-                    .scaled(9, 9, Qt::KeepAspectRatioByExpanding);
-        for (int y = 0; y < 8; y++) {
-            const uchar *line = image.scanLine(y);
-            // const uchar *nextLine = image.scanLine(y+1);
-            for (int x = 0; x < 8; x++) {
-                imageHash.setBit(y * 8 + x, line[x] > line[x + 1]);
-                // imageHash.setBit(y * 8 + x + 64, line[x] > nextLine[x]);
-            }
-        }
-
-        QString currentFilePath = thumbFileInfo.filePath();
-
-        totalFiles++;
-
-        if (dupImageHashes.contains(imageHash)) {
-            QStandardItem *item = nullptr;
-            if (dupImageHashes[imageHash].duplicates < 1) {
-                item = addThumb(dupImageHashes[imageHash].filePath);
-                if (item != nullptr) {
-                    item->setData(dupImageHashes[imageHash].id, SortRole);
-                }
-                originalImages++;
-            }
-
-            foundDups++;
-            dupImageHashes[imageHash].duplicates++;
-            item = addThumb(currentFilePath);
-            if (item != nullptr) {
-                item->setData(dupImageHashes[imageHash].id, SortRole);
-            }
-        } else {
-            DuplicateImage dupImage;
-            dupImage.filePath = currentFilePath;
-            dupImage.duplicates = 0;
-            dupImage.id = dupImageHashes.count();
-            dupImageHashes.insert(imageHash, dupImage);
+    const DuplicateImage &original = duplicateFinder.group(id);
+    int row = -1;
+    if (original.duplicatePaths.size() == 1) {
+        row = addThumb(original.filePath);
+        if (row >= 0) {
+            thumbsViewerModel->setData(thumbsViewerModel->index(row, 0), id, SortRole);
         }
+    }
 
-        updateFoundDupesState(foundDups, totalFiles, originalImages);
-
-        if (isAbortThumbsLoading) {
-            break;
-        }
+    row = addThumb(original.duplicatePaths.last());
+    if (row >= 0) {
+        thumbsViewerModel->setData(thumbsViewerModel->index(row, 0), id, SortRole);
     }
+}
 
-    updateFoundDupesState(foundDups, totalFiles, originalImages);
+bool ThumbsViewer::updateDupesProgress()
+{
+    updateFoundDupesState(duplicateFinder.duplicateCount(), duplicateFinder.scannedFiles(),
+                          duplicateFinder.originalCount());
+    thumbsViewerModel->sort(0);
+    QApplication::processEvents();
+    return !isAbortThumbsLoading;
+}
+
+void ThumbsViewer::findDupes(const QFileInfoList &fileInfos)
+{
+    thumbFileInfoList = fileInfos;
+    duplicateFinder.addImages(
+        fileInfos, [this](int id) { addDuplicate(id); }, [this] { return updateDupesProgress(); });
 }
 
 void ThumbsViewer::selectByBrightness(qreal min, qreal max)
@@ -955,46 +1328,29 @@ void ThumbsViewer::selectByBrightness(qreal min, qreal max)
 
 void ThumbsViewer::loadAllThumbs()
 {
-    QProgressDialog progress(tr("Loading thumbnails..."), tr("Abort"), 0, thumbFileInfoList.count(),
-                             this);
-    int processed = 0;
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        progress.setValue(i);
-        if (progress.wasCanceled())
-            break;
-        if (thumbsViewerModel->item(i)->data(LoadedRole).toBool())
-            continue;
-        loadThumb(i);
-
-        if (isAbortThumbsLoading) {
-            break;
-        }
-
-        if (++processed > BATCH_SIZE) {
-            QApplication::processEvents();
-            processed = 0;
+    const int rowCount = thumbsViewerModel->rowCount();
+    QProgressDialog progress(tr("Loading thumbnails..."), tr("Abort"), 0, rowCount, this);
+
+    bool queuedThumbs = true;
+    while (queuedThumbs) {
+        queuedThumbs = false;
+        for (int i = 0; i < thumbsViewerModel->rowCount(); ++i) {
+            if (!thumbsViewerModel->isLoaded(i)
+                && queueThumb(i, std::numeric_limits<int>::max(), false)) {
+                queuedThumbs = true;
+            }
         }
-    }
-}
 
-static Histogram calcHist(const QImage &img)
-{
-    Histogram hist;
-    if (img.isNull()) {
-        qWarning() << "Invalid file";
-        return hist;
-    }
-    const QImage image = img.scaled(256, 256).convertToFormat(QImage::Format_RGB888);
-    for (int y = 0; y < image.height(); y++) {
-        const uchar *line = image.scanLine(y);
-        for (int x = 0; x < image.width(); x++) {
-            const int index = x * 3;
-            hist.red[line[index + 0]] += 1.F;
-            hist.green[line[index + 1]] += 1.F;
-            hist.blue[line[index + 2]] += 1.F;
+        // Thumbnails are applied as their batches arrive from the workers
+        while (!pendingThumbs.isEmpty()) {
+            progress.setValue(rowCount - pendingThumbs.size());
+            if (progress.wasCanceled() || isAbortThumbsLoading) {
+                cancelPendingThumbs();
+                return;
+            }
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents);
         }
     }
-    return hist;
 }
 
 static Histogram calcHist(const QString &filePath)
@@ -1007,33 +1363,39 @@ static Histogram calcHist(const QString &filePath)
         qWarning() << "Invalid file" << filePath << reader.errorString();
         return {};
     }
-    return calcHist(image);
+    return Histogram::fromImage(image);
 }
 
 void ThumbsViewer::sortBySimilarity()
 {
-    QProgressDialog progress(tr("Loading..."), tr("Abort"), 0, thumbFileInfoList.count(), this);
+    const int rowCount = thumbsViewerModel->rowCount();
+    QProgressDialog progress(tr("Loading..."), tr("Abort"), 0, rowCount, this);
     progress.show();
     QApplication::processEvents();
 
+    // Loaded thumbnails come with their histogram, only the others need to be read
+    QVector<std::shared_ptr<const Histogram>> rowHistograms(rowCount);
     int processed = 0;
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        QStandardItem *item = thumbsViewerModel->item(i);
-
-        Q_ASSERT(item);
-        if (item == nullptr) {
-            continue;
-        }
-        const QString filename = item->data(FileNameRole).toString();
-        if (histFiles.contains(filename)) {
-            continue;
+    for (int row = 0; row < rowCount; ++row) {
+        std::shared_ptr<const Histogram> histogram = thumbsViewerModel->histogram(row);
+        if (!histogram) {
+            const QString filePath = thumbsViewerModel->filePath(row);
+            const std::shared_ptr<ImageFeatureStore> store =
+                ImageFeatureStore::forDirectory(QFileInfo(filePath).absolutePath());
+            histogram = store->findHistogram(filePath, thumbsViewerModel->lastModified(row),
+                                             thumbsViewerModel->fileSize(row));
+            if (!histogram) {
+                histogram = std::make_shared<const Histogram>(calcHist(filePath));
+                store->insertHistogram(filePath, thumbsViewerModel->lastModified(row),
+                                       thumbsViewerModel->fileSize(row), histogram);
+            }
+            thumbsViewerModel->setHistogram(row, histogram);
         }
-        histograms.append(calcHist(filename));
-        histFiles.append(filename);
+        rowHistograms[row] = histogram;
 
         if (++processed > BATCH_SIZE) {
             processed = 0;
-            progress.setValue(i);
+            progress.setValue(row);
             QApplication::processEvents();
             if (progress.wasCanceled()) {
                 return;
@@ -1043,371 +1405,239 @@ void ThumbsViewer::sortBySimilarity()
 
     progress.setLabelText(tr("Comparing..."));
     progress.setValue(0);
-
-    for (int i = 0; i < histFiles.size() - 1; i++) {
-        float minScore = std::numeric_limits<float>::max();
-        int minIndex = i + 1;
-
-        for (int j = i + 1; j < histFiles.size(); j++) {
-            const float score = histograms[i].compare(histograms[j]);
-            if (score > minScore) {
-                continue;
-            }
-            minIndex = j;
-            minScore = score;
-
-            processed++;
-        }
-        std::swap(histFiles[i + 1], histFiles[minIndex]);
-        std::swap(histograms[i + 1], histograms[minIndex]);
-
-        if (processed > BATCH_SIZE * 10) {
-            processed = 0;
-            progress.show();
-            progress.setValue(i);
+    const QVector<int> order =
+        SimilarityOrder::order(rowHistograms, [&progress](int ordered) {
+            progress.setValue(ordered);
             QApplication::processEvents();
-            if (progress.wasCanceled()) {
-                return;
-            }
-        }
+            return !progress.wasCanceled();
+        });
+    if (order.isEmpty()) {
+        return;
     }
 
-    progress.setLabelText(tr("Sorting..."));
-    progress.setMaximum(thumbFileInfoList.count() + 1); // + 1 for the call to sort() at the bottom
-    progress.setValue(0);
-    QHash<QString, int> indices;
-    for (int i = 0; i < histFiles.size(); i++) {
-        indices[histFiles[i]] = i;
-    }
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        QStandardItem *item = thumbsViewerModel->item(i);
-        Q_ASSERT(item);
-        if (item == nullptr) {
-            qWarning() << "Invalid item" << i;
-            continue;
-        }
-        const QString filename = item->data(FileNameRole).toString();
-        if (!indices.contains(filename)) {
-            qWarning() << "Invalid file" << filename;
-            continue;
-        }
-        item->setData(indices.size() - indices[filename], SortRole);
-
-        if (++processed > BATCH_SIZE) {
-            processed = 0;
-            progress.show();
-            progress.setValue(i);
-            QApplication::processEvents();
-            if (progress.wasCanceled()) {
-                return;
-            }
-        }
+    for (int i = 0; i < rowCount; ++i) {
+        thumbsViewerModel->setData(thumbsViewerModel->index(order[i], 0), rowCount - i, SortRole);
     }
-    QApplication::processEvents();
 
     thumbsViewerModel->setSortRole(SortRole);
     thumbsViewerModel->sort(0);
 }
 
-void ThumbsViewer::loadThumbsRange()
+int ThumbsViewer::thumbPriority(int row) const
 {
-    static bool isInProgress = false;
-    static int currentRowCount;
-    int currThumb;
+    if (firstVisibleThumb < 0 || lastVisibleThumb < 0) {
+        return row;
+    }
 
-    if (isInProgress) {
-        isAbortThumbsLoading = true;
-        QTimer::singleShot(0, this, SLOT(loadThumbsRange()));
-        return;
+    // Visible thumbs come first, in scrolling order. After them the ones the user is scrolling
+    // towards, then, at a much lower rate, the ones just left behind.
+    const int pageSize = lastVisibleThumb - firstVisibleThumb + 1;
+    const int aheadLimit = pageSize * (Settings::thumbsPagesReadCount + 1);
+    const int behindLimit = qMax(pageSize, BATCH_SIZE);
+    const int behindWeight = 4;
+
+    if (row >= firstVisibleThumb && row <= lastVisibleThumb) {
+        return scrolledForward ? row - firstVisibleThumb : lastVisibleThumb - row;
     }
 
-    isInProgress = true;
-    currentRowCount = thumbsViewerModel->rowCount();
+    const int distanceAhead = scrolledForward ? row - lastVisibleThumb : firstVisibleThumb - row;
+    if (distanceAhead > 0) {
+        return distanceAhead <= aheadLimit ? pageSize + distanceAhead : -1;
+    }
 
-    QElapsedTimer timer;
-    timer.start();
+    const int distanceBehind = scrolledForward ? firstVisibleThumb - row : row - lastVisibleThumb;
+    return distanceBehind <= behindLimit ? pageSize + distanceBehind * behindWeight : -1;
+}
+
+void ThumbsViewer::loadThumbsRange()
+{
+    // Reorder what is already queued by the distance from the viewport and drop the thumbs
+    // which left the prefetch window. The rest of the batch keeps going.
+    const QVector<ThumbnailRequest> cancelledRequests =
+        thumbnailLoader->reschedule([this](const ThumbnailRequest &request) {
+            const QPersistentModelIndex index = pendingThumbs.value(request.filePath);
+            const int priority = index.isValid() ? thumbPriority(index.row()) : -1;
+            return priority >= 0 && request.isRefinement ? refinementPriority(priority)
+                                                         : priority;
+        });
+    for (const ThumbnailRequest &request : cancelledRequests) {
+        const QPersistentModelIndex index = pendingThumbs.take(request.filePath);
+        // Still showing the embedded preview, so load it again once it comes back into view
+        if (request.isRefinement && index.isValid()) {
+            thumbsViewerModel->setLoaded(index.row(), false);
+        }
+    }
+
+    const int rowCount = thumbsViewerModel->rowCount();
+    int currThumb;
 
     for (scrolledForward ? currThumb = thumbsRangeFirst : currThumb = thumbsRangeLast;
          (scrolledForward ? currThumb <= thumbsRangeLast : currThumb >= thumbsRangeFirst);
          scrolledForward ? ++currThumb : --currThumb) {
 
-        if (isAbortThumbsLoading || thumbsViewerModel->rowCount() != currentRowCount
-            || currThumb < 0)
+        if (isAbortThumbsLoading || currThumb < 0 || currThumb >= rowCount)
             break;
 
-        if (thumbsViewerModel->item(currThumb)->data(LoadedRole).toBool())
+        if (thumbsViewerModel->isLoaded(currThumb))
             continue;
 
-        loadThumb(currThumb);
-
-        if (timer.elapsed() > 10) {
-            QApplication::processEvents();
-            timer.restart();
-        }
+        queueThumb(currThumb, qMax(0, thumbPriority(currThumb)));
     }
 
-    isInProgress = false;
-
     if (!isClosing) {
         isAbortThumbsLoading = false;
     }
 }
 
-QString ThumbsViewer::thumbnailFileName(const QString &originalPath) const
+ThumbnailRequest ThumbsViewer::thumbRequest(int row) const
 {
-    QFileInfo info(originalPath);
-    QString canonicalPath = info.canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << originalPath << "does not exist!";
-        canonicalPath = info.absoluteFilePath();
-    }
-    QUrl url = QUrl::fromLocalFile(canonicalPath);
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
-    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
+    const QString imageFileName = thumbsViewerModel->filePath(row);
+    ThumbnailRequest request;
+    request.filePath = imageFileName;
+    request.thumbSize = thumbSize;
+    request.layout = Settings::thumbsLayout;
+    request.generation = thumbsGeneration;
+    request.usePackedStore = Settings::thumbsPackedStore;
+    request.lastModified = thumbsViewerModel->lastModified(row);
+    request.fileSize = thumbsViewerModel->fileSize(row);
+    if (Settings::exifThumbRotationEnabled
+        && !metadataCache->getCachedImageOrientation(imageFileName, &request.orientation)) {
+        request.readOrientation = true;
+    }
+    return request;
 }
 
-QString ThumbsViewer::locateThumbnail(const QString &originalPath) const
+QString ThumbsViewer::thumbCacheKey(int row) const
 {
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return "";
-#endif
-    QStringList folders = {
-        QStringLiteral("xx-large/"), // max 1024px
-        QStringLiteral("x-large/"), // max 512px
-        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
-    };
-
-    if (thumbSize <= 200) {
-        folders.append(QStringLiteral("normal/")); // 128px max
-    }
-
-    const QString filename = thumbnailFileName(originalPath);
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
-        + QStringLiteral("/thumbnails/");
-    const QFileInfo originalInfo(originalPath);
-    for (const QString &folder : folders) {
-        QFileInfo info(basePath + folder + filename);
-        if (!info.exists()) {
-            continue;
-        }
-        if (originalInfo.metadataChangeTime() > info.lastModified()) {
-            continue;
-        }
-        if (originalInfo.lastModified() > info.lastModified()) {
-            continue;
-        }
-        return info.absoluteFilePath();
-    }
-    return QString();
+    return ThumbnailCache::key(thumbsViewerModel->filePath(row),
+                               thumbsViewerModel->lastModified(row),
+                               thumbsViewerModel->fileSize(row), thumbSize, Settings::thumbsLayout);
 }
 
-void ThumbsViewer::storeThumbnail(const QString &originalPath, QImage thumbnail,
-                                  const QSize &originalSize) const
+bool ThumbsViewer::queueThumb(int row, int priority, bool cancellable)
 {
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return;
-#endif
-    const QString canonicalPath = QFileInfo(originalPath).canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << "Asked to store thumbnail for non-existent path" << originalPath;
-        return;
-    }
-
-    QString folder = QStringLiteral("normal/");
-    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
-    if (maxSize < 64) {
-        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
-        return;
-    }
-    if (maxSize >= 1024) {
-        folder = QStringLiteral("xx-large/");
-        thumbnail = thumbnail.scaled(1024, 1024, Qt::KeepAspectRatio);
-    } else if (maxSize >= 512) {
-        folder = QStringLiteral("x-large/");
-        thumbnail = thumbnail.scaled(512, 512, Qt::KeepAspectRatio);
-    } else if (maxSize >= 256) {
-        folder = QStringLiteral("large/");
-        thumbnail = thumbnail.scaled(256, 256, Qt::KeepAspectRatio);
-    } else if (maxSize >= 128) {
-        folder = QStringLiteral("normal/");
-        thumbnail = thumbnail.scaled(128, 128, Qt::KeepAspectRatio);
-    } else {
-        qWarning() << "Thumbnail too small" << thumbnail.size();
-        return;
-    }
-
-    const QString filename = thumbnailFileName(originalPath);
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
-        + QStringLiteral("/thumbnails/");
-
-    if (!QFileInfo::exists(basePath + folder)) {
-        QDir().mkpath(basePath + folder);
+    const QString imageFileName = thumbsViewerModel->filePath(row);
+    if (pendingThumbs.contains(imageFileName)) {
+        return false;
     }
 
-    const QString fullPath = basePath + folder + filename;
-    QFileInfo info(fullPath);
-
-    QDateTime lastModified = info.lastModified();
-    if (info.metadataChangeTime() > info.lastModified()) {
-        lastModified = info.metadataChangeTime();
+    ThumbnailCache::Entry cachedThumb;
+    if (ThumbnailCache::find(thumbCacheKey(row), &cachedThumb)) {
+        setThumb(row, cachedThumb);
+        return false;
     }
-    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toTime_t()));
-
-    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
-    thumbnail.setText(QStringLiteral("Thumb::URI"), url.url());
 
-    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
-    thumbnail.setText(QStringLiteral("Thumb::Image::Height"),
-                      QString::number(originalSize.height()));
-    thumbnail.setText(QStringLiteral("Software"), QStringLiteral("Phototonic"));
-    thumbnail.convertToColorSpace(QColorSpace::SRgb);
+    ThumbnailRequest request = thumbRequest(row);
+    request.priority = priority;
+    request.cancellable = cancellable;
+    // Requests which have to finish anyway might as well produce the final thumbnail
+    request.allowEmbeddedPreview = cancellable;
 
-    thumbnail.save(fullPath);
+    pendingThumbs.insert(imageFileName, QPersistentModelIndex(thumbsViewerModel->index(row, 0)));
+    thumbnailLoader->enqueue(request);
+    return true;
 }
 
-bool ThumbsViewer::loadThumb(int currThumb)
+void ThumbsViewer::cancelPendingThumbs()
 {
-    QImageReader thumbReader;
-    QString imageFileName = thumbsViewerModel->item(currThumb)->data(FileNameRole).toString();
-    QImage thumb;
-    bool imageReadOk = false;
-    bool shouldStoreThumbnail = false;
-
-    thumbReader.setFileName(imageFileName);
-    thumbReader.setQuality(
-        50); // 50 is the threshold where Qt does fast decoding, but still good scaling
-    const QSize origThumbSize = thumbReader.size();
-    QSize currentThumbSize = origThumbSize;
-
-    QString thumbnailPath = locateThumbnail(imageFileName);
-    if (!thumbnailPath.isEmpty()) {
-        if (QImageReader(thumbnailPath).canRead()) {
-            thumbReader.setFileName(thumbnailPath);
-        } else {
-            qWarning() << "Invalid thumbnail" << thumbnailPath;
-            shouldStoreThumbnail = true;
-        }
-    } else {
-        shouldStoreThumbnail = true;
+    const QVector<ThumbnailRequest> cancelledRequests = thumbnailLoader->cancelPending();
+    for (const ThumbnailRequest &request : cancelledRequests) {
+        pendingThumbs.remove(request.filePath);
     }
+}
 
-    if (currentThumbSize.isValid()) {
-        if (currentThumbSize.width() != thumbSize || currentThumbSize.height() != thumbSize) {
-            currentThumbSize.scale(QSize(thumbSize, thumbSize),
-                                   Settings::thumbsLayout != Classic
-                                       ? Qt::KeepAspectRatioByExpanding
-                                       : Qt::KeepAspectRatio);
+void ThumbsViewer::onThumbnailsReady(const QVector<ThumbnailResult> &results)
+{
+    Trace::Scope trace("ThumbsViewer::onThumbnailsReady");
+    for (const ThumbnailResult &result : results) {
+        if (result.generation != thumbsGeneration) {
+            continue;
         }
 
-        thumbReader.setScaledSize(currentThumbSize);
-        imageReadOk = thumbReader.read(&thumb);
-
-        if (imageReadOk && !shouldStoreThumbnail) {
-            int w = thumb.text(QStringLiteral("Thumb::Image::Width")).toInt();
-            int h = thumb.text(QStringLiteral("Thumb::Image::Height")).toInt();
-            if (origThumbSize != QSize(w, h)) {
-                qWarning() << "Invalid size in stored thumbnail" << w << h << "vs" << origThumbSize;
-                shouldStoreThumbnail = true;
-                thumbReader.setFileName(imageFileName);
-                imageReadOk = thumbReader.read(&thumb);
-            }
+        const QPersistentModelIndex index = pendingThumbs.take(result.filePath);
+        if (!index.isValid()) {
+            continue;
         }
-    }
 
-    if (imageReadOk) {
-        if (shouldStoreThumbnail) {
-            storeThumbnail(imageFileName, thumb, origThumbSize);
-        }
-        if (Settings::exifThumbRotationEnabled) {
-            imageViewer->rotateByExifRotation(thumb, imageFileName);
-            currentThumbSize = thumb.size();
-            currentThumbSize.scale(QSize(thumbSize, thumbSize),
-                                   Settings::thumbsLayout != Classic
-                                       ? Qt::KeepAspectRatioByExpanding
-                                       : Qt::KeepAspectRatio);
+        // The file changed while it was decoded, the thumbnail would end up cached for the new
+        // contents
+        if (result.lastModified != thumbsViewerModel->lastModified(index.row())
+            || result.fileSize != thumbsViewerModel->fileSize(index.row())) {
+            queueThumb(index.row(), qMax(0, thumbPriority(index.row())));
+            continue;
         }
 
-        thumbsViewerModel->item(currThumb)->setData(qGray(thumb.scaled(1, 1).pixel(0, 0)) / 255.0,
-                                                    BrightnessRole);
+        applyThumbnail(index.row(), result);
 
-        if (Settings::thumbsLayout != Classic) {
-            thumb = SmartCrop::crop(thumb, QSize(thumbSize, thumbSize));
+        if (result.isPreview) {
+            // The preview stays up until the full decode has caught up with everything else
+            ThumbnailRequest request = thumbRequest(index.row());
+            request.priority = refinementPriority(qMax(0, thumbPriority(index.row())));
+            request.isRefinement = true;
+            pendingThumbs.insert(result.filePath, index);
+            thumbnailLoader->enqueue(request);
         }
+    }
+}
 
-        thumbsViewerModel->item(currThumb)->setIcon(QPixmap::fromImage(thumb));
-        thumbsViewerModel->item(currThumb)->setData(true, LoadedRole);
-        histograms.append(calcHist(thumb));
-        histFiles.append(imageFileName);
-        thumbsViewerModel->item(currThumb)->setSizeHint(itemSizeHint());
-    } else {
-        thumbsViewerModel->item(currThumb)->setIcon(
+int ThumbsViewer::refinementPriority(int priority)
+{
+    // Behind every first pass thumbnail, but before the ones queued by loadAllThumbs()
+    return qMin(priority, std::numeric_limits<int>::max() / 2)
+        + std::numeric_limits<int>::max() / 2 - 1;
+}
+
+void ThumbsViewer::applyThumbnail(int row, const ThumbnailResult &result)
+{
+    if (!result.ok) {
+        // Failed images are marked as loaded as well so they do not get queued over and over
+        thumbsViewerModel->setThumb(
+            row,
             QIcon::fromTheme("image-missing", QIcon(":/images/error_image.png"))
-                .pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE));
-        currentThumbSize.setHeight(BAD_IMAGE_SIZE);
-        currentThumbSize.setWidth(BAD_IMAGE_SIZE);
-        return false;
+                .pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE),
+            std::numeric_limits<qreal>::quiet_NaN(), nullptr);
+        return;
     }
-    return true;
+
+    ThumbnailCache::Entry thumb;
+    thumb.pixmap = QPixmap::fromImage(result.image);
+    thumb.brightness = result.brightness;
+    thumb.histogram = result.histogram;
+
+    // Previews are neither cached nor used for similarity, their refinement follows
+    if (result.isPreview) {
+        setThumb(row, thumb, false);
+        return;
+    }
+
+    ThumbnailCache::insert(thumbCacheKey(row), thumb);
+    setThumb(row, thumb);
 }
 
-QStandardItem *ThumbsViewer::addThumb(const QString &imageFullPath)
+void ThumbsViewer::setThumb(int row, const ThumbnailCache::Entry &thumb, bool isFinal)
 {
+    thumbsViewerModel->setThumb(row, thumb.pixmap, thumb.brightness,
+                                isFinal ? thumb.histogram : nullptr);
+}
 
-    metadataCache->loadImageMetadata(imageFullPath);
+int ThumbsViewer::addThumb(const QString &imageFullPath)
+{
     if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(imageFullPath)) {
-        return nullptr;
+        return -1;
     }
-
-    QStandardItem *thumbItem = new QStandardItem();
-    QImageReader thumbReader;
-    QSize hintSize = itemSizeHint();
-    QSize currThumbSize;
+    metadataCache->loadImageMetadataLater({imageFullPath});
 
     thumbFileInfo = QFileInfo(imageFullPath);
-    thumbItem->setData(true, LoadedRole);
-    thumbItem->setData(0, SortRole);
-    thumbItem->setData(thumbFileInfo.size(), SizeRole);
-    thumbItem->setData(thumbFileInfo.lastModified(), TimeRole);
-    thumbItem->setData(thumbFileInfo.suffix(), TypeRole);
-    thumbItem->setData(thumbFileInfo.filePath(), FileNameRole);
-    if (Settings::thumbsLayout != Squares) {
-        thumbItem->setTextAlignment(Qt::AlignTop | Qt::AlignHCenter);
-        thumbItem->setData(thumbFileInfo.fileName(), Qt::DisplayRole);
-    }
-    thumbItem->setSizeHint(hintSize);
-
-    thumbReader.setFileName(imageFullPath);
-    currThumbSize = thumbReader.size();
-    if (currThumbSize.isValid()) {
-        if (currThumbSize.width() > thumbSize || currThumbSize.height() > thumbSize) {
-            currThumbSize.scale(QSize(thumbSize, thumbSize),
-                                Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding
-                                                                  : Qt::KeepAspectRatio);
-        }
-
-        thumbReader.setScaledSize(currThumbSize);
-        QImage thumb = thumbReader.read();
-
-        if (Settings::exifThumbRotationEnabled) {
-            imageViewer->rotateByExifRotation(thumb, imageFullPath);
-            currThumbSize = thumb.size();
-            currThumbSize.scale(QSize(thumbSize, thumbSize),
-                                Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding
-                                                                  : Qt::KeepAspectRatio);
-        }
-        thumbItem->setData(qGray(thumb.scaled(1, 1).pixel(0, 0)) / 255.0, BrightnessRole);
+    const int row = thumbsViewerModel->appendThumb(thumbFileInfo, 0);
 
-        thumbItem->setIcon(QPixmap::fromImage(thumb));
+    ThumbnailCache::Entry cachedThumb;
+    if (ThumbnailCache::find(thumbCacheKey(row), &cachedThumb)) {
+        setThumb(row, cachedThumb);
     } else {
-        thumbItem->setIcon(QIcon::fromTheme("image-missing", QIcon(":/images/error_image.png"))
-                               .pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE));
-        currThumbSize.setHeight(BAD_IMAGE_SIZE);
-        currThumbSize.setWidth(BAD_IMAGE_SIZE);
+        applyThumbnail(row, ThumbnailLoader::loadThumbnail(thumbRequest(row)));
     }
 
-    thumbsViewerModel->appendRow(thumbItem);
-    return thumbItem;
+    return row;
 }
 
 void ThumbsViewer::mousePressEvent(QMouseEvent *event)
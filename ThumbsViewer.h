@@ -18,65 +18,37 @@
 
 #pragma once
 
+#include "Histogram.h"
+#include "DuplicateFinder.h"
 #include "MetadataCache.h"
+#include "ThumbnailCache.h"
+#include "ThumbsModel.h"
 
-#include <QBitArray>
 #include <QDir>
 #include <QFileInfoList>
+#include <QFileSystemWatcher>
+#include <QHash>
 #include <QListView>
+#include <QPersistentModelIndex>
+#include <QSet>
 #include <QTimer>
 
-#include <cmath>
 #include <exiv2/exiv2.hpp>
 
 class ImagePreview;
 class ImageViewer;
 class Phototonic;
-class QStandardItem;
-class QStandardItemModel;
+class ThumbnailLoader;
+struct ThumbnailRequest;
+struct ThumbnailResult;
 
 #define BAD_IMAGE_SIZE 64
 #define WINDOW_ICON_SIZE 48
 
+class FileNameFilter;
 class ImageTags;
 class InfoView;
 
-struct DuplicateImage
-{
-    QString filePath;
-    int duplicates;
-    int id = 0;
-};
-
-struct Histogram
-{
-    float red[256]{};
-    float green[256]{};
-    float blue[256]{};
-
-    inline float compareChannel(const float hist1[256], const float hist2[256])
-    {
-        float len1 = 0.F, len2 = 0.F, corr = 0.F;
-
-        for (uint16_t i = 0; i < 256; i++) {
-            len1 += hist1[i];
-            len2 += hist2[i];
-            corr += std::sqrt(hist1[i] * hist2[i]);
-        }
-
-        const float part1 = 1.F / std::sqrt(len1 * len2);
-
-        return std::sqrt(1.F - part1 * corr);
-    }
-
-    inline float compare(const Histogram &other)
-    {
-        return compareChannel(red, other.red) + compareChannel(green, other.green)
-            + compareChannel(blue, other.blue);
-    }
-};
-Q_DECLARE_METATYPE(Histogram);
-
 class ThumbsViewer : public QListView {
     Q_OBJECT
 
@@ -127,7 +99,8 @@ public:
 
     void selectCurrentIndex();
 
-    QStandardItem *addThumb(const QString &imageFullPath);
+    // Returns the row of the new thumb, or -1 if it is filtered out
+    int addThumb(const QString &imageFullPath);
 
     void abort(bool permanent = false);
 
@@ -153,12 +126,18 @@ public:
 
     void sortBySimilarity();
 
+    // The first and the last row with the bottom edge inside the viewport, -1 if there is none.
+    // Both work for any view laying out its rows line by line in model order.
+    [[nodiscard]] static int firstVisibleRow(const QListView *view);
+
+    [[nodiscard]] static int lastVisibleRow(const QListView *view);
+
     InfoView *infoView;
     ImagePreview *imagePreview;
     ImageTags *imageTags;
     QDir thumbsDir;
     QStringList fileFilters;
-    QStandardItemModel *thumbsViewerModel;
+    ThumbsModel *thumbsViewerModel;
     QDir::SortFlags thumbsSortFlags;
     int thumbSize;
     QString filterString;
@@ -171,13 +150,52 @@ protected:
 private:
     void initThumbs();
 
-    bool loadThumb(int row);
+    bool queueThumb(int row, int priority = 0, bool cancellable = true);
+
+    [[nodiscard]] int thumbPriority(int row) const;
+
+    [[nodiscard]] static int refinementPriority(int priority);
+
+    void cancelPendingThumbs();
 
-    void findDupes(bool resetCounters);
+    [[nodiscard]] ThumbnailRequest thumbRequest(int row) const;
 
-    int getFirstVisibleThumb();
+    [[nodiscard]] QString thumbCacheKey(int row) const;
 
-    int getLastVisibleThumb();
+    void applyThumbnail(int row, const ThumbnailResult &result);
+
+    void setThumb(int row, const ThumbnailCache::Entry &thumb, bool isFinal = true);
+
+    void onThumbnailsReady(const QVector<ThumbnailResult> &results);
+
+    // Appends the files of one directory, sorted by thumbsSortFlags and without the ones the
+    // tag filter hides
+    void appendSortedThumbs(const QFileInfoList &fileInfos);
+
+    // Shows the duplicate just added to the group, and its original along with the first one
+    void addDuplicate(int id);
+
+    // Shows the progress between chunks of a duplicate search, returns false to abort it
+    bool updateDupesProgress();
+
+    void findDupes(const QFileInfoList &fileInfos);
+
+    void watchDirectories(const QStringList &directories);
+
+    // Brings the rows of the directory in line with its files on disk. The sub-directories it
+    // starts watching are added to watchedDirectories.
+    void updateDirectory(const QString &directory, const FileNameFilter &fileNameFilter,
+                         QSet<QString> *watchedDirectories);
+
+    // Shows the new files of watched directories the tag filter lets through, once their tags
+    // are loaded
+    void onImageMetadataLoaded(const QStringList &imageFullPaths);
+
+    // Moves the rows of the directory with the given path prefix together into the sort order,
+    // at the place of its first row
+    void sortDirectoryRows(const QString &prefix, const QHash<QString, QFileInfo> &fileInfos);
+
+    [[nodiscard]] static int thumbBottom(const QListView *view, int row);
 
     void updateThumbsCount();
 
@@ -187,21 +205,27 @@ private:
 
     [[nodiscard]] QSize itemSizeHint() const;
 
-    [[nodiscard]] QString thumbnailFileName(const QString &path) const;
-    [[nodiscard]] QString locateThumbnail(const QString &path) const;
-    void storeThumbnail(const QString &originalPath, QImage thumbnail,
-                        const QSize &originalSize) const;
-
     QFileInfo thumbFileInfo;
     QFileInfoList thumbFileInfoList;
-    QList<Histogram> histograms;
-    QList<QString> histFiles;
     QPixmap emptyImg;
     QModelIndex currentIndex;
     Phototonic *phototonic;
     std::shared_ptr<MetadataCache> metadataCache;
     ImageViewer *imageViewer;
-    QHash<QBitArray, DuplicateImage> dupImageHashes;
+    ThumbnailLoader *thumbnailLoader;
+    QHash<QString, QPersistentModelIndex> pendingThumbs;
+    int thumbsGeneration = 0;
+    DuplicateFinder duplicateFinder;
+    QFileSystemWatcher directoryWatcher;
+    QSet<QString> changedDirectories;
+    // New files of watched directories waiting for their tags while the tag filter is on, by the
+    // path prefix of the directory, along with all its files as listed to sort them in with
+    struct DirectoryAwaitingTags
+    {
+        QHash<QString, QFileInfo> fileInfos;
+        QSet<QString> fileNames;
+    };
+    QHash<QString, DirectoryAwaitingTags> directoriesAwaitingTags;
     bool isAbortThumbsLoading = false;
     bool isClosing = false;
     bool isNeedToScroll = false;
@@ -209,9 +233,12 @@ private:
     bool scrolledForward = false;
     int thumbsRangeFirst;
     int thumbsRangeLast;
+    int firstVisibleThumb = -1;
+    int lastVisibleThumb = -1;
 
     QTimer m_selectionChangedTimer;
     QTimer m_loadThumbTimer;
+    QTimer m_directoryChangeTimer;
 
 public slots:
 
@@ -226,4 +253,6 @@ private slots:
     void loadThumbsRange();
 
     void loadAllThumbs();
+
+    void applyDirectoryChanges();
 };
@@ -0,0 +1,237 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Trace.h"
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThread>
+
+#include <memory>
+#include <vector>
+
+namespace Trace {
+std::atomic<bool> enabled(false);
+}
+
+namespace { // anonymous, not visible outside of this file
+
+// Bounds the memory of a trace left running for hours
+const size_t maxEventsPerThread = 1 << 20;
+
+struct Event
+{
+    const char *name;
+    QString detail;
+    qint64 startTime;
+    qint64 duration;
+};
+
+struct ThreadBuffer
+{
+    int threadId = 0;
+    QString threadName;
+    // Only ever contended while the trace is written
+    QMutex mutex;
+    std::vector<Event> events;
+    size_t droppedEvents = 0;
+};
+
+QMutex traceMutex;
+bool isStarted = false;
+QString traceFilePath;
+QThread *guiThread = nullptr;
+QElapsedTimer traceClock;
+// Owns the buffers, so they outlive their threads until the trace is written
+std::vector<std::shared_ptr<ThreadBuffer>> threadBuffers;
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+// The event loop gets a track of its own, its spans do not nest with the scopes
+ThreadBuffer *eventLoopBuffer = nullptr;
+qint64 eventLoopAwakeTime = -1;
+QMetaObject::Connection awakeConnection;
+QMetaObject::Connection aboutToBlockConnection;
+
+ThreadBuffer *addThreadBuffer(const QString &threadName)
+{
+    auto buffer = std::make_shared<ThreadBuffer>();
+    QMutexLocker locker(&traceMutex);
+    buffer->threadId = int(threadBuffers.size()) + 1;
+    buffer->threadName =
+        threadName.isEmpty() ? QStringLiteral("Thread %1").arg(buffer->threadId) : threadName;
+    threadBuffers.push_back(buffer);
+    return buffer.get();
+}
+
+ThreadBuffer *currentThreadBuffer()
+{
+    if (threadBuffer == nullptr) {
+        QThread *thread = QThread::currentThread();
+        threadBuffer = addThreadBuffer(thread == guiThread ? QStringLiteral("GUI thread")
+                                                           : thread->objectName());
+    }
+    return threadBuffer;
+}
+
+void addEvent(ThreadBuffer *buffer, const char *name, const QString &detail, qint64 startTime,
+              qint64 endTime)
+{
+    QMutexLocker locker(&buffer->mutex);
+    if (buffer->events.size() >= maxEventsPerThread) {
+        ++buffer->droppedEvents;
+        return;
+    }
+    buffer->events.push_back({name, detail, startTime, endTime - startTime});
+}
+
+QString jsonString(const QString &string)
+{
+    QString escaped;
+    escaped.reserve(string.size() + 2);
+    escaped += QLatin1Char('"');
+    for (const QChar character : string) {
+        if (character == QLatin1Char('"') || character == QLatin1Char('\\')) {
+            escaped += QLatin1Char('\\');
+            escaped += character;
+        } else if (character.unicode() < 0x20) {
+            escaped += QStringLiteral("\\u%1").arg(character.unicode(), 4, 16, QLatin1Char('0'));
+        } else {
+            escaped += character;
+        }
+    }
+    escaped += QLatin1Char('"');
+    return escaped;
+}
+
+QString microseconds(qint64 nanoseconds)
+{
+    return QString::number(double(nanoseconds) / 1e3, 'f', 3);
+}
+
+void writeEvents(QTextStream &out)
+{
+    const QString pid = QString::number(QCoreApplication::applicationPid());
+    const char *separator = "";
+    QMutexLocker locker(&traceMutex);
+    for (const std::shared_ptr<ThreadBuffer> &buffer : threadBuffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        const QString tid = QString::number(buffer->threadId);
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << tid << ",\"args\":{\"name\":" << jsonString(buffer->threadName)
+            << "}}";
+        separator = ",\n";
+
+        for (const Event &event : buffer->events) {
+            out << separator << "{\"name\":" << jsonString(QLatin1String(event.name))
+                << ",\"cat\":\"phototonic\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+                << ",\"ts\":" << microseconds(event.startTime)
+                << ",\"dur\":" << microseconds(event.duration);
+            if (!event.detail.isEmpty()) {
+                out << ",\"args\":{\"detail\":" << jsonString(event.detail) << '}';
+            }
+            out << '}';
+        }
+
+        if (buffer->droppedEvents > 0) {
+            qWarning() << "Trace dropped" << buffer->droppedEvents << "events of"
+                       << buffer->threadName;
+        }
+    }
+}
+} // namespace
+
+namespace Trace {
+
+void start(const QString &filePath)
+{
+    if (isStarted || filePath.isEmpty()) {
+        return;
+    }
+    isStarted = true;
+    traceFilePath = filePath;
+    guiThread = QThread::currentThread();
+    traceClock.start();
+
+    if (QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance()) {
+        eventLoopBuffer = addThreadBuffer(QStringLiteral("GUI event loop"));
+        awakeConnection = QObject::connect(dispatcher, &QAbstractEventDispatcher::awake, [] {
+            eventLoopAwakeTime = traceClock.nsecsElapsed();
+        });
+        aboutToBlockConnection =
+            QObject::connect(dispatcher, &QAbstractEventDispatcher::aboutToBlock, [] {
+                if (eventLoopAwakeTime >= 0) {
+                    addEvent(eventLoopBuffer, "eventLoop", QString(), eventLoopAwakeTime,
+                             traceClock.nsecsElapsed());
+                    eventLoopAwakeTime = -1;
+                }
+            });
+    }
+
+    enabled.store(true, std::memory_order_release);
+}
+
+void startFromEnvironment()
+{
+    if (qEnvironmentVariableIsSet("PHOTOTONIC_TRACE")) {
+        start(qEnvironmentVariable("PHOTOTONIC_TRACE"));
+    }
+}
+
+void stop()
+{
+    if (!enabled.exchange(false)) {
+        return;
+    }
+    QObject::disconnect(awakeConnection);
+    QObject::disconnect(aboutToBlockConnection);
+
+    QSaveFile file(traceFilePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write trace to" << traceFilePath << file.errorString();
+        return;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    writeEvents(out);
+    out << "\n]}\n";
+    out.flush();
+    if (!file.commit()) {
+        qWarning() << "Failed to write trace to" << traceFilePath << file.errorString();
+    }
+}
+
+void Scope::begin(const char *name, const QString &detail)
+{
+    this->name = name;
+    this->detail = detail;
+    startTime = traceClock.nsecsElapsed();
+}
+
+void Scope::end()
+{
+    if (enabled.load(std::memory_order_relaxed)) {
+        addEvent(currentThreadBuffer(), name, detail, startTime, traceClock.nsecsElapsed());
+    }
+}
+}
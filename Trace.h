@@ -0,0 +1,73 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+
+// Records begin and end of scopes on all threads and writes them as a trace event JSON file,
+// to be loaded into Perfetto or chrome://tracing. Off unless started by --trace FILE or the
+// PHOTOTONIC_TRACE environment variable, until then a Scope costs one atomic load. While
+// tracing, a separate track shows when the GUI thread's event loop is awake, so every stall of
+// the user interface stands out.
+namespace Trace {
+
+extern std::atomic<bool> enabled;
+
+// Events are collected from now on and written to filePath by stop(). Called on the GUI thread
+// once the application object exists, only the first call counts.
+void start(const QString &filePath);
+
+// Starts tracing if PHOTOTONIC_TRACE names a file
+void startFromEnvironment();
+
+// Writes the trace, if one was started
+void stop();
+
+// name has to outlive the trace, like a string literal. The detail, a file name for example,
+// shows up in the arguments of the event.
+class Scope {
+public:
+    explicit Scope(const char *name, const QString &detail = QString())
+    {
+        if (enabled.load(std::memory_order_acquire)) {
+            begin(name, detail);
+        }
+    }
+
+    ~Scope()
+    {
+        if (this->name != nullptr) {
+            end();
+        }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    void begin(const char *name, const QString &detail);
+
+    void end();
+
+    const char *name = nullptr;
+    QString detail;
+    qint64 startTime = 0;
+};
+}
@@ -0,0 +1,54 @@
+#
+#  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+#  This file is part of Phototonic Image Viewer.
+#
+#  Phototonic is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Phototonic is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+TEMPLATE = app
+TARGET = phototonic
+include(phototonic.pri)
+
+SOURCES += main.cpp
+
+target.path = /usr/bin/
+
+icon.files = images/phototonic.png
+icon.path = /usr/share/icons/hicolor/48x48/apps
+
+icon16.files = images/icon16/phototonic.png
+icon16.path = /usr/share/icons/hicolor/16x16/apps
+
+iconPixmaps.files = images/icon16/phototonic.png
+iconPixmaps.path = /usr/share/pixmaps
+
+desktop.files = phototonic.desktop
+desktop.path = /usr/share/applications
+
+metainfo.files = phototonic.appdata.xml
+metainfo.path = /usr/share/metainfo
+
+INSTALLS += target icon icon16 iconPixmaps desktop metainfo
+
+TRANSLATIONS = 	translations/phototonic_en.ts \
+		translations/phototonic_pl.ts \
+		translations/phototonic_de.ts \
+		translations/phototonic_ru.ts \
+		translations/phototonic_cs.ts \
+		translations/phototonic_fr.ts \
+		translations/phototonic_bs.ts \
+		translations/phototonic_hr.ts \
+		translations/phototonic_sr.ts \
+		translations/phototonic_pt.ts
+
@@ -0,0 +1,533 @@
+/*
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Histogram.h"
+#include "ImageHash.h"
+#include "ImageViewer.h"
+#include "MetadataCache.h"
+#include "Settings.h"
+#include "SimilarityOrder.h"
+#include "SmartCrop.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailWriter.h"
+#include "ThumbsModel.h"
+#include "ThumbsViewer.h"
+
+#include <QDir>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QListView>
+#include <QRandomGenerator>
+#include <QScrollBar>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <algorithm>
+#include <memory>
+
+#include <exiv2/exiv2.hpp>
+
+// Times the per image hot paths of thumbnailing, the duplicate search and the image viewer on
+// a synthetic corpus of assorted sizes, formats and EXIF orientations, and the visible range
+// lookup of thumbnail views of growing size. The corpus is generated from fixed seeds, so
+// results of different builds on the same machine can be compared, for example as JSON with
+//
+//   benchmarks -o results.json,json
+//
+// Every image of the corpus is a data row of its own. Runs on a single thread.
+class HotPathBenchmark : public QObject {
+    Q_OBJECT
+
+public:
+    // Called by QTEST_MAIN before the QApplication is created, the view needs no display
+    static void initMain();
+
+private slots:
+    void initTestCase();
+
+    void thumbnailDecode_data();
+    void thumbnailDecode();
+    void thumbnailStore_data();
+    void thumbnailStore();
+    void thumbnailLocate_data();
+    void thumbnailLocate();
+    void thumbnailLoad_data();
+    void thumbnailLoad();
+    void histogram_data();
+    void histogram();
+    void smartCrop_data();
+    void smartCrop();
+    void imageHash_data();
+    void imageHash();
+    void imageHashKernel_data();
+    void imageHashKernel();
+    void similarityOrder_data();
+    void similarityOrder();
+    void exifOrientationRead_data();
+    void exifOrientationRead();
+    void exifOrientationRotate_data();
+    void exifOrientationRotate();
+    void colorize_data();
+    void colorize();
+    void thumbsViewVisibleRange_data();
+    void thumbsViewVisibleRange();
+
+private:
+    struct CorpusImage
+    {
+        QString filePath;
+        QSize size;
+        qint64 fileSize = 0;
+    };
+
+    static const int thumbSize = 200;
+
+    // Gradients with blocks of flat color and some noise on top, so the encoders get something
+    // in between a flat image and random data
+    static QImage syntheticImage(const QSize &size, quint32 seed);
+
+    static void writeOrientation(const QString &filePath, long orientation);
+
+    static QImage readImage(const QString &filePath);
+
+    // Three sizes in three formats, three images each. JPEGs cycle through all EXIF orientations.
+    void createCorpus();
+
+    // One data row with the index of every image in the corpus
+    void addCorpusRows();
+
+    ThumbnailRequest thumbnailRequest(int index, unsigned int layout) const;
+
+    QTemporaryDir temporaryDir;
+    QVector<CorpusImage> corpus;
+    QVector<QImage> thumbs;
+    QVector<QImage> expandedThumbs;
+};
+
+void HotPathBenchmark::initMain()
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+}
+
+void HotPathBenchmark::initTestCase()
+{
+    QVERIFY(temporaryDir.isValid());
+
+    // Keeps the thumbnails of the corpus out of the user's thumbnail store
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(temporaryDir.filePath(QStringLiteral("cache"))));
+
+    // Not thread safe, so it has to happen before anything reads metadata
+    Exiv2::XmpParser::initialize();
+
+    createCorpus();
+    QVERIFY(!corpus.isEmpty());
+
+    thumbs.resize(corpus.size());
+    expandedThumbs.resize(corpus.size());
+    for (int index = 0; index < corpus.size(); ++index) {
+        thumbs[index] = ThumbnailLoader::readThumbnail(
+            thumbnailRequest(index, ThumbsViewer::Classic), false);
+        expandedThumbs[index] = ThumbnailLoader::readThumbnail(
+            thumbnailRequest(index, ThumbsViewer::Squares), false);
+    }
+
+    // A moderate adjustment which goes through every step of ImageViewer::colorizeImage()
+    Settings::hueVal = 10;
+    Settings::saturationVal = 120;
+    Settings::lightnessVal = 100;
+    Settings::contrastVal = 90;
+    Settings::brightVal = 110;
+    Settings::redVal = 0;
+    Settings::greenVal = 0;
+    Settings::blueVal = 0;
+    Settings::colorizeEnabled = false;
+    Settings::rNegateEnabled = false;
+    Settings::gNegateEnabled = false;
+    Settings::bNegateEnabled = false;
+    Settings::hueRedChannel = true;
+    Settings::hueGreenChannel = true;
+    Settings::hueBlueChannel = true;
+}
+
+QImage HotPathBenchmark::syntheticImage(const QSize &size, quint32 seed)
+{
+    QRandomGenerator generator(seed);
+    QImage image(size, QImage::Format_RGB32);
+    for (int y = 0; y < size.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const int noise = int(generator.bounded(16));
+            line[x] = qRgb((x * 255 / size.width() + noise) & 255,
+                           (y * 255 / size.height() + noise) & 255, ((x ^ y) + noise) & 255);
+        }
+    }
+
+    for (int block = 0; block < 16; ++block) {
+        const QRect rect(int(generator.bounded(size.width())),
+                         int(generator.bounded(size.height())), size.width() / 8,
+                         size.height() / 8);
+        const QRgb color = generator.generate() | 0xff000000;
+        const QRect clipped = rect.intersected(image.rect());
+        for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+            QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+            std::fill(line + clipped.left(), line + clipped.right() + 1, color);
+        }
+    }
+    return image;
+}
+
+void HotPathBenchmark::writeOrientation(const QString &filePath, long orientation)
+{
+    try {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+        Exiv2::Image::AutoPtr exifImage = Exiv2::ImageFactory::open(filePath.toStdString());
+#pragma clang diagnostic pop
+        exifImage->readMetadata();
+        exifImage->exifData()["Exif.Image.Orientation"] = uint16_t(orientation);
+        exifImage->writeMetadata();
+    } catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+    }
+}
+
+QImage HotPathBenchmark::readImage(const QString &filePath)
+{
+    QImage image;
+    QImageReader(filePath).read(&image);
+    return image;
+}
+
+void HotPathBenchmark::createCorpus()
+{
+    const QSize sizes[] = {QSize(640, 480), QSize(1600, 1200), QSize(3000, 2000)};
+    QList<QByteArray> formats = {"jpg", "png"};
+    formats.append(QImageWriter::supportedImageFormats().contains("tiff") ? "tiff" : "bmp");
+
+    quint32 seed = 1;
+    for (const QSize &size : sizes) {
+        for (const QByteArray &format : qAsConst(formats)) {
+            for (int variant = 0; variant < 3; ++variant, ++seed) {
+                CorpusImage corpusImage;
+                corpusImage.filePath = QDir(temporaryDir.path())
+                                           .filePath(QStringLiteral("image%1.%2")
+                                                         .arg(seed)
+                                                         .arg(QString::fromLatin1(format)));
+                corpusImage.size = size;
+                const QImage image = syntheticImage(size, seed);
+                if (!image.save(corpusImage.filePath, format.constData(), 90)) {
+                    qWarning() << "Failed to write" << corpusImage.filePath;
+                    continue;
+                }
+                if (format == "jpg") {
+                    writeOrientation(corpusImage.filePath, long(seed % 8) + 1);
+                }
+                corpusImage.fileSize = QFileInfo(corpusImage.filePath).size();
+                corpus.append(corpusImage);
+            }
+        }
+    }
+}
+
+void HotPathBenchmark::addCorpusRows()
+{
+    QTest::addColumn<int>("index");
+    for (int index = 0; index < corpus.size(); ++index) {
+        const CorpusImage &corpusImage = corpus.at(index);
+        QTest::newRow(qPrintable(QStringLiteral("%1 %2x%3")
+                                     .arg(QFileInfo(corpusImage.filePath).fileName())
+                                     .arg(corpusImage.size.width())
+                                     .arg(corpusImage.size.height())))
+            << index;
+    }
+}
+
+ThumbnailRequest HotPathBenchmark::thumbnailRequest(int index, unsigned int layout) const
+{
+    ThumbnailRequest request;
+    request.filePath = corpus.at(index).filePath;
+    request.thumbSize = thumbSize;
+    request.layout = layout;
+    request.lastModified = QFileInfo(request.filePath).lastModified();
+    request.fileSize = corpus.at(index).fileSize;
+    request.readOrientation = true;
+    return request;
+}
+
+void HotPathBenchmark::thumbnailDecode_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::thumbnailDecode()
+{
+    QFETCH(int, index);
+    const ThumbnailRequest request = thumbnailRequest(index, ThumbsViewer::Classic);
+    QBENCHMARK {
+        ThumbnailLoader::readThumbnail(request, false);
+    }
+}
+
+void HotPathBenchmark::thumbnailStore_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::thumbnailStore()
+{
+    QFETCH(int, index);
+    QBENCHMARK {
+        ThumbnailLoader::storeThumbnail(corpus.at(index).filePath, thumbs.at(index),
+                                        corpus.at(index).size);
+        ThumbnailWriter::waitForDone();
+    }
+}
+
+void HotPathBenchmark::thumbnailLocate_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::thumbnailLocate()
+{
+    QFETCH(int, index);
+    QBENCHMARK {
+        ThumbnailLoader::locateThumbnail(corpus.at(index).filePath, thumbSize);
+    }
+}
+
+void HotPathBenchmark::thumbnailLoad_data()
+{
+    addCorpusRows();
+}
+
+// Everything a thumbnail costs once it is in the store: reading it, the EXIF orientation and the
+// histogram
+void HotPathBenchmark::thumbnailLoad()
+{
+    QFETCH(int, index);
+    const ThumbnailRequest request = thumbnailRequest(index, ThumbsViewer::Classic);
+    QBENCHMARK {
+        ThumbnailLoader::loadThumbnail(request);
+    }
+}
+
+void HotPathBenchmark::histogram_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::histogram()
+{
+    QFETCH(int, index);
+    QBENCHMARK {
+        Histogram::fromImage(thumbs.at(index));
+    }
+}
+
+void HotPathBenchmark::smartCrop_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::smartCrop()
+{
+    QFETCH(int, index);
+    QBENCHMARK {
+        SmartCrop::crop(expandedThumbs.at(index), QSize(thumbSize, thumbSize));
+    }
+}
+
+void HotPathBenchmark::imageHash_data()
+{
+    QTest::addColumn<int>("index");
+    QTest::addColumn<int>("method");
+    for (int index = 0; index < corpus.size(); ++index) {
+        const QString fileName = QFileInfo(corpus.at(index).filePath).fileName();
+        QTest::newRow(qPrintable(QStringLiteral("difference %1").arg(fileName)))
+            << index << int(ImageHash::DifferenceHash);
+        QTest::newRow(qPrintable(QStringLiteral("dct %1").arg(fileName)))
+            << index << int(ImageHash::DctHash);
+    }
+}
+
+void HotPathBenchmark::imageHash()
+{
+    QFETCH(int, index);
+    QFETCH(int, method);
+    quint64 hash;
+    QBENCHMARK {
+        ImageHash::read(corpus.at(index).filePath, ImageHash::Method(method), &hash);
+    }
+}
+
+void HotPathBenchmark::imageHashKernel_data()
+{
+    imageHash_data();
+}
+
+// The hash kernels alone, on the grayscale images ImageHash::read() hands them
+void HotPathBenchmark::imageHashKernel()
+{
+    QFETCH(int, index);
+    QFETCH(int, method);
+    const QImage gray = thumbs.at(index).convertToFormat(QImage::Format_Grayscale8);
+    volatile quint64 hash = 0;
+    if (method == ImageHash::DifferenceHash) {
+        const QImage image = gray.scaled(9, 9, Qt::KeepAspectRatioByExpanding);
+        QBENCHMARK {
+            hash = ImageHash::differenceHash(image);
+        }
+    } else {
+        const QImage image = gray.scaled(32, 32, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        QBENCHMARK {
+            hash = ImageHash::dctHash(image);
+        }
+    }
+}
+
+void HotPathBenchmark::similarityOrder_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("3000") << 3000;
+    QTest::newRow("30000") << 30000;
+}
+
+// Histograms of small synthetic images, ordered as a whole. Larger sets take seconds per pass.
+void HotPathBenchmark::similarityOrder()
+{
+    QFETCH(int, count);
+    QVector<std::shared_ptr<const Histogram>> histograms;
+    histograms.reserve(count);
+    for (int seed = 0; seed < count; ++seed) {
+        histograms.append(std::make_shared<const Histogram>(
+            Histogram::fromImage(syntheticImage(QSize(32, 24), quint32(seed)))));
+    }
+    QBENCHMARK {
+        SimilarityOrder::order(histograms);
+    }
+}
+
+void HotPathBenchmark::exifOrientationRead_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::exifOrientationRead()
+{
+    QFETCH(int, index);
+    QBENCHMARK {
+        MetadataCache::readImageOrientation(corpus.at(index).filePath);
+    }
+}
+
+void HotPathBenchmark::exifOrientationRotate_data()
+{
+    addCorpusRows();
+}
+
+// The viewer works on full size images, decoded outside of the measured part
+void HotPathBenchmark::exifOrientationRotate()
+{
+    QFETCH(int, index);
+    const QImage image = readImage(corpus.at(index).filePath);
+    QBENCHMARK {
+        QImage rotated = image;
+        // Rotated by 90 degrees, like most portrait photos
+        ImageViewer::rotateByExifOrientation(rotated, 6);
+    }
+}
+
+void HotPathBenchmark::colorize_data()
+{
+    addCorpusRows();
+}
+
+void HotPathBenchmark::colorize()
+{
+    QFETCH(int, index);
+    const QImage image = readImage(corpus.at(index).filePath);
+    QImage colorized;
+    QBENCHMARK {
+        colorized = ImageViewer::colorizeImage(image);
+    }
+}
+
+void HotPathBenchmark::thumbsViewVisibleRange_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<int>("position");
+    const struct
+    {
+        const char *name;
+        int percentage;
+    } positions[] = {{"top", 0}, {"middle", 50}, {"bottom", 100}};
+    for (int rows : {1000, 10000, 100000}) {
+        for (const auto &position : positions) {
+            QTest::newRow(qPrintable(QStringLiteral("%1 %2").arg(rows).arg(position.name)))
+                << rows << position.percentage;
+        }
+    }
+}
+
+// A view set up like ThumbsViewer with the classic layout, scrolled to the given percentage.
+// Every iteration looks up the first and the last visible row. Both bisect the rows, so this is
+// O(log n) and not constant: 100000 rows take about 17 probes per lookup where 1000 take 10.
+void HotPathBenchmark::thumbsViewVisibleRange()
+{
+    QFETCH(int, rows);
+    QFETCH(int, position);
+
+    ThumbsModel model;
+    QListView view;
+    view.setViewMode(QListView::IconMode);
+    view.setResizeMode(QListView::Adjust);
+    view.setWrapping(true);
+    view.setUniformItemSizes(false);
+    view.setSpacing(QFontMetrics(view.font()).height());
+    view.setVerticalScrollMode(QAbstractItemView::ScrollPerItem);
+    model.setItemSizeHint(
+        QSize(thumbSize, thumbSize + int(QFontMetrics(view.font()).height() * 1.5)));
+
+    QFileInfoList fileInfos;
+    QVector<int> sortKeys;
+    for (int row = 0; row < rows; ++row) {
+        fileInfos.append(QFileInfo(
+            QDir(temporaryDir.path()).filePath(QStringLiteral("row%1.jpg").arg(row))));
+        sortKeys.append(row);
+    }
+    model.appendThumbs(fileInfos, sortKeys);
+    view.setModel(&model);
+    view.resize(1280, 800);
+    view.show();
+    view.doItemsLayout();
+
+    QScrollBar *scrollBar = view.verticalScrollBar();
+    scrollBar->setValue(scrollBar->maximum() * position / 100);
+    volatile int firstRow = 0;
+    volatile int lastRow = 0;
+    QBENCHMARK {
+        firstRow = ThumbsViewer::firstVisibleRow(&view);
+        lastRow = ThumbsViewer::lastVisibleRow(&view);
+    }
+}
+
+QTEST_MAIN(HotPathBenchmark)
+
+#include "HotPathBenchmark.moc"
@@ -0,0 +1,27 @@
+#
+#  This file is part of Phototonic Image Viewer.
+#
+#  Phototonic is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Phototonic is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# QBENCHMARK suites over the image hot paths, not installed. Run them with
+#   ./benchmarks -o results.json,json
+# to compare builds.
+
+TEMPLATE = app
+TARGET = benchmarks
+QT += testlib
+include(../phototonic.pri)
+
+SOURCES += HotPathBenchmark.cpp
@@ -16,7 +16,10 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "BatchMode.h"
 #include "Phototonic.h"
+#include "PipelineStats.h"
+#include "Trace.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
@@ -25,6 +28,13 @@
 
 int main(int argc, char *argv[])
 {
+    // Batch commands run without a display, so they must not create a QApplication
+    if (BatchMode::isRequested(argc, argv)) {
+        const int exitCode = BatchMode::run(argc, argv);
+        Trace::stop();
+        return exitCode;
+    }
+
     QApplication QApp(argc, argv);
     QLocale locale = QLocale::system();
     QCoreApplication::setApplicationVersion(VERSION);
@@ -49,8 +59,27 @@ int main(int argc, char *argv[])
         QCoreApplication::translate("main", "directory"));
     parser.addOption(targetDirectoryOption);
 
+    QCommandLineOption pipelineStatsOption(
+        QStringLiteral("pipeline-stats"),
+        QCoreApplication::translate("main",
+                                    "Write thumbnail pipeline statistics to <file> on exit."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(pipelineStatsOption);
+
+    QCommandLineOption traceOption(
+        QStringLiteral("trace"),
+        QCoreApplication::translate("main", "Record a trace of the image loading into <file>."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(traceOption);
+
     parser.process(QApp);
 
+    if (parser.isSet(traceOption)) {
+        Trace::start(parser.value(traceOption));
+    } else {
+        Trace::startFromEnvironment();
+    }
+
     if (parser.isSet(langOption))
         locale = QLocale(parser.value(langOption));
 
@@ -68,5 +97,10 @@ int main(int argc, char *argv[])
     if (parser.isSet(targetDirectoryOption))
         phototonic.setSaveDirectory(parser.value(targetDirectoryOption));
     phototonic.show();
-    return QApp.exec();
+    const int exitCode = QApp.exec();
+    if (parser.isSet(pipelineStatsOption)) {
+        PipelineStats::writeJson(parser.value(pipelineStatsOption));
+    }
+    Trace::stop();
+    return exitCode;
 }
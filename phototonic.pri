@@ -0,0 +1,72 @@
+#
+#  This file is part of Phototonic Image Viewer.
+#
+#  Phototonic is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Phototonic is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Everything but main(), shared by the application and the benchmarks
+
+INCLUDEPATH += $$PWD
+INCLUDEPATH += /usr/local/include
+win32-g++ {
+MINGWEXIVPATH = $$PWD/mingw
+
+LIBS += -L$$MINGWEXIVPATH/lib/ -lexiv2 -lexpat -lz
+
+INCLUDEPATH += $$MINGWEXIVPATH/include
+DEPENDPATH += $$MINGWEXIVPATH/include
+
+PRE_TARGETDEPS += $$MINGWEXIVPATH/lib/libexiv2.a $$MINGWEXIVPATH/lib/libexpat.a $$MINGWEXIVPATH/lib/libz.a
+}
+else: LIBS += -L/usr/local/lib -lexiv2
+QT += widgets
+QMAKE_CXXFLAGS += $$(CXXFLAGS)
+QMAKE_CFLAGS += $$(CFLAGS)
+QMAKE_LFLAGS += $$(LDFLAGS)
+CONFIG += c++17
+
+# Let's get some basic optimization from the compiler, it's the safe ones by default
+CONFIG += optimize
+
+HEADERS += $$PWD/Phototonic.h $$PWD/ThumbsViewer.h $$PWD/ImageViewer.h $$PWD/CropRubberband.h \
+			$$PWD/SettingsDialog.h $$PWD/Settings.h $$PWD/InfoViewer.h $$PWD/FileSystemTree.h \
+			$$PWD/Bookmarks.h $$PWD/DirCompleter.h $$PWD/Tags.h $$PWD/MetadataCache.h \
+			$$PWD/ShortcutsTable.h $$PWD/CopyMoveDialog.h $$PWD/CopyMoveToDialog.h $$PWD/CropDialog.h \
+			$$PWD/ProgressDialog.h $$PWD/ColorsDialog.h $$PWD/ResizeDialog.h $$PWD/ExternalAppsDialog.h \
+			$$PWD/ImagePreview.h $$PWD/ImageWidget.h $$PWD/FileSystemModel.h $$PWD/FileListWidget.h \
+			$$PWD/RenameDialog.h $$PWD/Trashcan.h $$PWD/MessageBox.h $$PWD/GuideWidget.h \
+			$$PWD/RangeInputDialog.h $$PWD/SmartCrop.h $$PWD/Histogram.h $$PWD/ThumbnailLoader.h \
+			$$PWD/ThumbnailCache.h $$PWD/ThumbnailPack.h $$PWD/ThumbnailWriter.h $$PWD/ThumbsModel.h \
+			$$PWD/Parallel.h $$PWD/DirectoryWalker.h $$PWD/SimilarityOrder.h $$PWD/ImageHashIndex.h \
+			$$PWD/FileHash.h $$PWD/ImageFeatureStore.h $$PWD/ImageHash.h $$PWD/DuplicateFinder.h \
+			$$PWD/BatchMode.h $$PWD/PipelineStats.h $$PWD/Trace.h $$PWD/ImagePrefetcher.h
+
+SOURCES += $$PWD/Phototonic.cpp $$PWD/ThumbsViewer.cpp $$PWD/ImageViewer.cpp $$PWD/CropRubberband.cpp \
+			$$PWD/SettingsDialog.cpp $$PWD/Settings.cpp $$PWD/InfoViewer.cpp $$PWD/FileSystemTree.cpp \
+			$$PWD/Bookmarks.cpp $$PWD/DirCompleter.cpp $$PWD/Tags.cpp $$PWD/MetadataCache.cpp \
+			$$PWD/ShortcutsTable.cpp $$PWD/CopyMoveDialog.cpp $$PWD/CopyMoveToDialog.cpp \
+			$$PWD/CropDialog.cpp $$PWD/ProgressDialog.cpp $$PWD/ExternalAppsDialog.cpp \
+			$$PWD/ColorsDialog.cpp $$PWD/ResizeDialog.cpp $$PWD/ImagePreview.cpp $$PWD/ImageWidget.cpp \
+			$$PWD/FileSystemModel.cpp $$PWD/FileListWidget.cpp $$PWD/RenameDialog.cpp \
+			$$PWD/Trashcan.cpp $$PWD/MessageBox.cpp $$PWD/GuideWidget.cpp $$PWD/RangeInputDialog.cpp \
+			$$PWD/IconProvider.cpp $$PWD/SmartCrop.cpp $$PWD/Histogram.cpp $$PWD/ThumbnailLoader.cpp \
+			$$PWD/ThumbnailCache.cpp $$PWD/ThumbnailPack.cpp $$PWD/ThumbnailWriter.cpp \
+			$$PWD/ThumbsModel.cpp $$PWD/DirectoryWalker.cpp $$PWD/SimilarityOrder.cpp \
+			$$PWD/ImageHashIndex.cpp $$PWD/FileHash.cpp $$PWD/ImageFeatureStore.cpp $$PWD/ImageHash.cpp \
+			$$PWD/DuplicateFinder.cpp $$PWD/BatchMode.cpp $$PWD/PipelineStats.cpp $$PWD/Trace.cpp \
+			$$PWD/ImagePrefetcher.cpp
+
+FORMS += $$PWD/RangeInputDialog.ui
+
+RESOURCES += $$PWD/phototonic.qrc